@@ -27,891 +27,3857 @@
 
 static QString apikey;
 static QString output_file;
+static QString input_file;
+static QString data_file;
+static int num_threads = 1;
+static unsigned daemon_interval;
+static QString fetch_url;
+static QByteArray fetch_modified;
+static QByteArray fetch_etag;
+static int fetch_timeout = 60;
+static int input_format = FORMAT_XML;
+static double tile_size;
+static bool coord_stream;
+static int server_port;
+static QVector<int> emit_format;
+static QStringList emit_file;
+static QMutex server_mtx;
+static nobild_index *server_index;
+static int stats_mode;
+static nobild_stats stats;
+static QString rules_file;
+
+/* owners and plug types, with the fallback last */
+static QVector<nobild_class> nobild_owner;
+static QVector<nobild_class> nobild_type;
+static nobild_matcher nobild_owner_match;
+static nobild_matcher nobild_type_match;
+static int owner_other;
+static int type_other;
+
+/* upper limits of the kW ranges, in units of 0.1 kW */
+static QVector<uint16_t> kw_limit;
+static uint32_t key_max;
+
+/* the filter dimensions, most significant first in the sort */
+static nobild_dim nobild_dims[DIM_MAX] = {
+	{ "owner", "Select vendor", "owners", false, 0, 0, 0, 0 },
+	{ "kw", "Select power", "kw", false, 0, 0, 0, 0 },
+	{ "type", "Select plug", "types", true, 0, 0, 0, 0 },
+	{ "h24", "Select hours", "hours", false, 0, 0, 0, 0 },
+};
+
+/* stations and output groups kept from the last refresh, by key */
+static nobild_store nobild_prev;
+static QHash<QString, size_t> nobild_prev_index;
+static QHash<uint64_t, nobild_group> nobild_groups;
+static QHash<uint64_t, nobild_group> nobild_groups_next;
+
+static QString icon_url[ICON_MAX] = {
+	"http://www.selasky.org/charging/gfx_map_symbol_low.png",
+	"http://www.selasky.org/charging/gfx_map_symbol_blue_low.png"
+};
+
+static const char *nobild_tag_name[TAG_MAX] = {
+	"",
+	"chargerstations",
+	"chargerstation",
+	"metadata",
+	"id",
+	"position",
+	"name",
+	"owned_by",
+	"user_comment",
+	"attributes",
+	"station",
+	"connectors",
+	"connector",
+	"attribute",
+	"attrtypeid",
+	"attrvalid",
+	"trans",
+};
+
+static uint64_t
+NobildHashValue(uint64_t hash, uint64_t value)
+{
+	hash ^= value;
+	hash *= NOBILD_HASH_PRIME;
+	return (hash);
+}
+
+static uint64_t
+NobildHashString(uint64_t hash, const QChar *ptr, int len)
+{
+	for (int x = 0; x != len; x++)
+		hash = NobildHashValue(hash, ptr[x].unicode());
+	return (hash);
+}
+
+/*
+ * The built-in rules, used when no rules file is given. Owners and
+ * plug types are listed in the order they are presented. The patterns
+ * are matched case insensitively, and the first pattern in the file
+ * found in a string decides. The owner patterns name their owner, so
+ * that they can be listed in order of priority.
+ */
+static const char nobild_default_rules[] =
+    "owner \"Recharge\" \"http://www.rechargeinfra.com\"\n"
+    "owner \"Mer\" \"https://no.mer.eco\"\n"
+    "owner \"Bee\" \"https://bee.se\"\n"
+    "owner \"Eviny\" \"https://www.eviny.no\"\n"
+    "owner \"Clever\" \"https://clever.dk\"\n"
+    "owner \"E.ON\" \"https://www.eon.com\"\n"
+    "owner \"Tesla\" \"https://www.tesla.com\"\n"
+    "owner \"Ionity\" \"https://ionity.eu\"\n"
+    "prefix \"BEE \" \"Bee\"\n"
+    "prefix \"EVINY \" \"Eviny\"\n"
+    "prefix \"BKK \" \"Eviny\"\n"
+    "contains \"CLEVER\" \"Clever\"\n"
+    "contains \"E.ON\" \"E.ON\"\n"
+    "contains \"FORTUM\" \"Recharge\"\n"
+    "prefix \"RECHARGE \" \"Recharge\"\n"
+    "contains \"GR\xc3\x98NN KONTAKT\" \"Mer\"\n"
+    "prefix \"MER \" \"Mer\"\n"
+    "contains \"TESLA\" \"Tesla\"\n"
+    "contains \"IONITY\" \"Ionity\"\n"
+    "type \"CCS\" \"CCS EUR\" \"https://en.wikipedia.org/wiki/Combined_Charging_System\"\n"
+    "contains \"CCS\"\n"
+    "type \"CHA\" \"CHAdeMO\" \"https://en.wikipedia.org/wiki/CHAdeMO\"\n"
+    "contains \"CHAdeMO\"\n"
+    "type \"TP2\" \"Type 2\" \"https://en.wikipedia.org/wiki/Type_2_connector\"\n"
+    "contains \"Type 2\"\n"
+    "type \"TES\" \"Tesla connector\" \"https://en.wikipedia.org/wiki/Tesla_Supercharger\"\n"
+    "contains \"Tesla Connector Model\"\n";
+
+void
+nobild_matcher::clear()
+{
+	next.clear();
+	parent.clear();
+	symbol.clear();
+	depth.clear();
+	fail.clear();
+	out.clear();
+	dict.clear();
+	value.clear();
+	length.clear();
+	prefix.clear();
+
+	/* the root state */
+	parent.append(0);
+	symbol.append(0);
+	depth.append(0);
+	fail.append(0);
+	out.append(-1);
+	dict.append(-1);
+}
+
+void
+nobild_matcher::add(const QString &str, int _value, bool _prefix)
+{
+	int state = 0;
+
+	for (int x = 0; x != str.size(); x++) {
+		const ushort ch = str[x].toUpper().unicode();
+		const uint64_t key = ((uint64_t)state << 16) | ch;
+		int temp = next.value(key, -1);
+
+		if (temp < 0) {
+			temp = fail.size();
+			parent.append(state);
+			symbol.append(ch);
+			depth.append(x + 1);
+			fail.append(0);
+			out.append(-1);
+			dict.append(-1);
+			next.insert(key, temp);
+		}
+		state = temp;
+	}
+
+	/* of equal patterns, the first one wins */
+	if (out[state] < 0)
+		out[state] = value.size();
+	value.append(_value);
+	length.append(str.size());
+	prefix.append(_prefix);
+}
+
+void
+nobild_matcher::build()
+{
+	int max = 0;
+
+	for (int x = 0; x != depth.size(); x++) {
+		if (depth[x] > max)
+			max = depth[x];
+	}
+
+	/* the fail state of each state is less deep, so go by depth */
+	for (int d = 2; d <= max; d++) {
+		for (int x = 0; x != depth.size(); x++) {
+			if (depth[x] != d)
+				continue;
+
+			int state = fail[parent[x]];
+			int temp;
+
+			while ((temp = next.value(((uint64_t)state << 16) | symbol[x], -1)) < 0 &&
+			    state != 0)
+				state = fail[state];
+
+			fail[x] = (temp < 0) ? 0 : temp;
+			dict[x] = (out[fail[x]] >= 0) ? fail[x] : dict[fail[x]];
+		}
+	}
+}
+
+int
+nobild_matcher::match(const QString &str, int fallback) const
+{
+	const QChar *ptr = str.constData();
+	int state = 0;
+	int best = -1;
+
+	for (int x = 0; x != str.size() && best != 0; x++) {
+		const ushort ch = ptr[x].toUpper().unicode();
+		int temp;
+
+		while ((temp = next.value(((uint64_t)state << 16) | ch, -1)) < 0 &&
+		    state != 0)
+			state = fail[state];
+		state = (temp < 0) ? 0 : temp;
+
+		/* check all patterns ending here */
+		for (int y = (out[state] >= 0) ? state : dict[state]; y >= 0; y = dict[y]) {
+			const int pattern = out[y];
+
+			if (prefix[pattern] && length[pattern] != x + 1)
+				continue;
+			if (best < 0 || pattern < best)
+				best = pattern;
+		}
+	}
+	return ((best < 0) ? fallback : value[best]);
+}
+
+static int
+NobildStr2Owner(const QString &str)
+{
+	return (nobild_owner_match.match(str, owner_other));
+}
+
+static int
+NobildStr2Type(const QString &str)
+{
+	return (nobild_type_match.match(str, type_other));
+}
+
+static	QString
+NobildOwner2Str(int value)
+{
+	return (nobild_owner[value].name);
+}
+
+static	QString
+NobildOwner2Link(int value)
+{
+	return (nobild_owner[value].link);
+}
+
+static	QString
+NobildType2Str(int value)
+{
+	return (nobild_type[value].name);
+}
+
+static	QString
+NobildType2StrFull(int value)
+{
+	return (nobild_type[value].full);
+}
+
+static	QString
+NobildType2Link(int value)
+{
+	return (nobild_type[value].link);
+}
+
+static bool
+NobildRulesSplit(const QString &line, QStringList &args)
+{
+	int x = 0;
+
+	args.clear();
+
+	while (1) {
+		while (x != line.size() && line[x].isSpace())
+			x++;
+		if (x == line.size() || line[x] == '#')
+			return (true);
+
+		if (line[x] == '"') {
+			const int end = line.indexOf('"', x + 1);
+
+			if (end < 0)
+				return (false);
+			args.append(line.mid(x + 1, end - x - 1));
+			x = end + 1;
+		} else {
+			const int start = x;
+
+			while (x != line.size() && !line[x].isSpace())
+				x++;
+			args.append(line.mid(start, x - start));
+		}
+	}
+}
+
+/*
+ * Each line of the rules has a keyword followed by double quoted
+ * strings. "owner" takes the name and a link, and "type" the short
+ * name, the full name and a link. The "contains" and "prefix" lines
+ * which follow give the patterns selecting that owner or plug type.
+ */
+static int
+NobildRulesFind(const QVector<nobild_class> &list, const QString &name)
+{
+	for (int x = 0; x != list.size(); x++) {
+		if (list[x].name == name)
+			return (x);
+	}
+	return (-1);
+}
+
+static int
+NobildRulesParse(const QByteArray &text, int &line)
+{
+	const QStringList lines = QString::fromUtf8(text).split('\n');
+	QVector<nobild_class> owner;
+	QVector<nobild_class> type;
+	nobild_matcher owner_match;
+	nobild_matcher type_match;
+	nobild_matcher *pmatch = NULL;
+	QVector<nobild_class> *plist = NULL;
+	QStringList args;
+	int index;
+
+	for (line = 1; line <= lines.size(); line++) {
+		if (!NobildRulesSplit(lines[line - 1], args))
+			return (EINVAL);
+		if (args.isEmpty())
+			continue;
+
+		if (args[0] == "owner" && args.size() == 3 &&
+		    owner.size() < NOBILD_OWNER_MAX - 1) {
+			owner.append(nobild_class(args[1], args[1], args[2]));
+			pmatch = &owner_match;
+			plist = &owner;
+		} else if (args[0] == "type" && args.size() == 4 &&
+		    type.size() < NOBILD_TYPE_MAX - 1) {
+			type.append(nobild_class(args[1], args[2], args[3]));
+			pmatch = &type_match;
+			plist = &type;
+		} else if ((args[0] == "contains" || args[0] == "prefix") &&
+		    (args.size() == 2 || args.size() == 3) &&
+		    !args[1].isEmpty() && pmatch != NULL) {
+			/* the last declared entry, unless one is named */
+			if (args.size() == 3)
+				index = NobildRulesFind(*plist, args[2]);
+			else
+				index = plist->size() - 1;
+			if (index < 0)
+				return (EINVAL);
+			pmatch->add(args[1], index, args[0] == "prefix");
+		} else {
+			return (EINVAL);
+		}
+	}
+
+	owner.append(nobild_class("Other", "Other", "index.html"));
+	type.append(nobild_class("UNK", "Other", "index.html"));
+	owner_match.build();
+	type_match.build();
+
+	nobild_owner = owner;
+	nobild_type = type;
+	nobild_owner_match = owner_match;
+	nobild_type_match = type_match;
+	owner_other = owner.size() - 1;
+	type_other = type.size() - 1;
+	return (0);
+}
+
+static int
+NobildKWIndex(uint16_t capacity)
+{
+	int x;
+
+	for (x = 0; x != kw_limit.size() && capacity >= kw_limit[x]; x++)
+		;
+	return (x);
+}
+
+static QString
+NobildKWBound(int x)
+{
+	if (x == 0)
+		return ("0");
+	else if (x > kw_limit.size())
+		return ("max");
+	else
+		return (QString::number(kw_limit[x - 1] / (double)NOBILD_KW(1)));
+}
+
+static QString
+NobildKWRange(int x)
+{
+	return (NobildKWBound(x) + "-" + NobildKWBound(x + 1));
+}
+
+static QString
+NobildTypeList(uint32_t mask)
+{
+	QString str;
+
+	for (int x = 0; x != nobild_type.size(); x++) {
+		if (!(mask & (1U << x)))
+			continue;
+		if (!str.isEmpty())
+			str += "+";
+		str += NobildType2Str(x);
+	}
+	return (str);
+}
+
+static void
+NobildDimInit(void)
+{
+	uint32_t stride = 1;
+	int offset = 0;
+
+	nobild_dims[DIM_OWNER].choices = nobild_owner.size();
+	nobild_dims[DIM_KW].choices = kw_limit.size() + 1;
+	nobild_dims[DIM_TYPE].choices = nobild_type.size();
+	nobild_dims[DIM_24H].choices = 2;
+
+	for (int d = 0; d != DIM_MAX; d++) {
+		nobild_dim &dim = nobild_dims[d];
+
+		dim.values = dim.set ? (1 << dim.choices) : dim.choices;
+		dim.offset = offset;
+		offset += dim.values;
+	}
+
+	for (int d = DIM_MAX; d--; ) {
+		nobild_dims[d].stride = stride;
+		stride *= nobild_dims[d].values;
+	}
+	key_max = stride;
+}
+
+static int
+NobildDimValue(const nobild_station *pst, int dim)
+{
+	switch (dim) {
+	case DIM_OWNER:
+		return (pst->owner);
+	case DIM_KW:
+		return (NobildKWIndex(pst->capacity_max));
+	case DIM_TYPE:
+		return (pst->get_type_mask());
+	default:
+		return ((pst->flags & FLAG_24H) ? 0 : 1);
+	}
+}
+
+static QString
+NobildDimChoice(int dim, int choice)
+{
+	switch (dim) {
+	case DIM_OWNER:
+		return (NobildOwner2Str(choice));
+	case DIM_KW:
+		return (NobildKWRange(choice));
+	case DIM_TYPE:
+		return (NobildType2Str(choice));
+	default:
+		return (choice ? "not 24/7" : "24/7");
+	}
+}
+
+/*
+ * The key of a station packs its value in every dimension, in mixed
+ * radix. It is computed once, when the station is parsed, and is the
+ * only thing the sort and the filters look at.
+ */
+static uint32_t
+NobildKey(const nobild_station *pst)
+{
+	uint32_t key = 0;
+
+	for (int d = 0; d != DIM_MAX; d++)
+		key += NobildDimValue(pst, d) * nobild_dims[d].stride;
+	return (key);
+}
+
+static int
+NobildKeyValue(uint32_t key, int dim)
+{
+	return ((key / nobild_dims[dim].stride) % nobild_dims[dim].values);
+}
+
+static bool
+NobildKeyChoice(uint32_t key, int dim, int choice)
+{
+	const int value = NobildKeyValue(key, dim);
+
+	if (nobild_dims[dim].set)
+		return ((value >> choice) & 1);
+	else
+		return (value == choice);
+}
+
+static QString
+NobildKeyText(uint32_t key, int dim)
+{
+	if (nobild_dims[dim].set)
+		return (NobildTypeList(NobildKeyValue(key, dim)));
+	else
+		return (NobildDimChoice(dim, NobildKeyValue(key, dim)));
+}
+
+static void
+NobildKeyBits(uint32_t key, nobild_key &bits)
+{
+	bits.clear();
+	for (int d = 0; d != DIM_MAX; d++)
+		bits.set(nobild_dims[d].offset + NobildKeyValue(key, d));
+}
+
+/* the bits of all values not selected by the given choices */
+static void
+NobildKeyExclude(const int64_t *mask, nobild_key &bits)
+{
+	bits.clear();
+	for (int d = 0; d != DIM_MAX; d++) {
+		const nobild_dim &dim = nobild_dims[d];
+
+		for (int v = 0; v != dim.values; v++) {
+			if (dim.set ? !(v & mask[d]) : !((mask[d] >> v) & 1))
+				bits.set(dim.offset + v);
+		}
+	}
+}
+
+/*
+ * Characters which must be escaped inside a double quoted JavaScript
+ * string literal. Zero means the character is copied as-is, 'u' means
+ * it is written as a \uXXXX sequence. The less-than character is
+ * escaped, so that the output can also be embedded inline in HTML.
+ */
+static const uint8_t nobild_js_escape[128] = {
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	0, 0, '"', 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 'u', 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, '\\', 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 'u',
+};
+
+static unsigned
+NobildDecodeUTF8(const char *ptr, size_t len, size_t &x, unsigned ch)
+{
+	unsigned num;
+
+	if (ch >= 0xF8)
+		return (0xFFFD);
+	else if (ch >= 0xF0)
+		num = 3, ch &= 0x07;
+	else if (ch >= 0xE0)
+		num = 2, ch &= 0x0F;
+	else if (ch >= 0xC0)
+		num = 1, ch &= 0x1F;
+	else
+		return (0xFFFD);
+
+	while (num--) {
+		if (x == len || ((uint8_t)ptr[x] & 0xC0) != 0x80)
+			return (0xFFFD);
+		ch = (ch << 6) | ((uint8_t)ptr[x++] & 0x3F);
+	}
+	return (ch);
+}
+
+static void
+JavaScriptEscapeChar(nobild_sink &output, unsigned ch)
+{
+	static const char hex[16] = {
+	    '0', '1', '2', '3', '4', '5', '6', '7',
+	    '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'
+	};
+	const char buf[6] = {
+	    '\\', 'u', hex[(ch >> 12) & 15], hex[(ch >> 8) & 15],
+	    hex[(ch >> 4) & 15], hex[ch & 15]
+	};
+
+	output.append(buf, sizeof(buf));
+}
+
+static void
+JavaScriptEscape(nobild_sink &output, const char *ptr, size_t len)
+{
+	size_t x = 0;
+
+	output += '"';
+
+	while (x != len) {
+		size_t run;
+		unsigned ch;
+
+		/* copy runs of characters which need no escaping at once */
+		for (run = x; run != len && (uint8_t)ptr[run] < 128 &&
+		     nobild_js_escape[(uint8_t)ptr[run]] == 0; run++)
+			;
+		if (run != x) {
+			output.append(ptr + x, run - x);
+			x = run;
+			continue;
+		}
+
+		ch = (uint8_t)ptr[x++];
+
+		if (ch >= 128) {
+			/* non-ASCII is escaped, so the charset does not matter */
+			ch = NobildDecodeUTF8(ptr, len, x, ch);
+			if (ch >= 0x10000) {
+				ch -= 0x10000;
+				JavaScriptEscapeChar(output, 0xD800 | (ch >> 10));
+				ch = 0xDC00 | (ch & 0x3FF);
+			}
+			JavaScriptEscapeChar(output, ch);
+		} else if (nobild_js_escape[ch] == 'u') {
+			JavaScriptEscapeChar(output, ch);
+		} else {
+			output += '\\';
+			output += (char)nobild_js_escape[ch];
+		}
+	}
+
+	output += '"';
+}
+
+static void
+JavaScriptEscape(nobild_sink &output, const QString &input)
+{
+	const QByteArray utf8 = input.toUtf8();
+
+	JavaScriptEscape(output, utf8.constData(), utf8.size());
+}
+
+static void
+JavaScriptVariable(nobild_sink &output, const char *variable, const QString &input)
+{
+	output += "var ";
+	output += variable;
+	output += " = ";
+	JavaScriptEscape(output, input);
+	output += ";\n";
+}
+
+static const char nobild_gpx_head[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+    "<gpx xmlns=\"http://www.topografix.com/GPX/1/1\" "
+    "xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\" "
+    "xsi:schemaLocation=\"http://www.topografix.com/GPX/1/1 http://www.topografix.com/GPX/1/1/gpx.xsd\" version=\"1.1\" "
+    "creator=\"Data provided by http://nobil.no and processed by http://www.selasky.org/charging\">\n";
+
+static const char nobild_gpx_tail[] = "</gpx>\n";
+
+/* the icon URL is inserted between these parts */
+static const char *nobild_kml_head[3] = {
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+    "<kml xmlns=\"http://www.opengis.net/kml/2.2\" xmlns:gx=\"http://www.google.com/kml/ext/2.2\">\n"
+    "<Document>\n"
+    "<name>EV charging stations</name>\n"
+    "<snippet>Data provided by http://nobil.no and processed by http://www.selasky.org/charging</snippet>\n"
+    "<LookAt>\n"
+    "<longitude>15</longitude>\n"
+    "<latitude>63</latitude>\n"
+    "<range>2560000</range>\n"
+    "</LookAt>\n"
+    "<Style id=\"waypoint_n\">\n"
+    "<IconStyle>\n"
+    "<Icon>\n"
+    "<href>",
+
+    "</href>\n"
+    "</Icon>\n"
+    "</IconStyle>\n"
+    "</Style>\n"
+    "<Style id=\"waypoint_h\">\n"
+    "<IconStyle>\n"
+    "<scale>1.2</scale>\n"
+    "<Icon>\n"
+    "<href>",
+
+    "</href>\n"
+    "</Icon>\n"
+    "</IconStyle>\n"
+    "</Style>\n"
+    "<StyleMap id=\"waypoint\">\n"
+    "<Pair>\n"
+    "<key>normal</key>\n"
+    "<styleUrl>#waypoint_n</styleUrl>\n"
+    "</Pair>\n"
+    "<Pair>\n"
+    "<key>highlight</key>\n"
+    "<styleUrl>#waypoint_h</styleUrl>\n"
+    "</Pair>\n"
+    "</StyleMap>\n"
+    "<Folder>\n"
+    "<name>EV charging stations</name>\n"
+};
+
+static const char nobild_kml_tail[] =
+    "</Folder>\n"
+    "</Document>\n"
+    "</kml>\n";
+
+/* the same characters as NobildXMLEscape() */
+static void
+NobildOutputXMLEscape(nobild_sink &output)
+{
+	output += "function xml_escape(str) {\n";
+	output += "return str.replace(/&/g, '&amp;').replace(/</g, '&lt;')"
+	    ".replace(/>/g, '&gt;').replace(/\"/g, '&quot;');\n";
+	output += "}\n";
+}
+
+static void
+NobildOutputGPXTemplate(nobild_sink &output)
+{
+	JavaScriptVariable(output, "gpx_head", nobild_gpx_head);
+	JavaScriptVariable(output, "gpx_tail", nobild_gpx_tail);
+
+	output += "function gpx_station(title, lat, lon) {\n";
+	output += "return '<wpt lat=\"' + lat + '\" lon=\"' + lon + '\"><name>' + xml_escape(title) + '</name></wpt>\\n';\n";
+	output += "}\n";
+}
+
+static void
+NobildOutputKMLTemplate(nobild_sink &output)
+{
+	output += "var kml_head = [\n";
+	for (int x = 0; x != 3; x++) {
+		if (x != 0)
+			output += ",\n";
+		JavaScriptEscape(output, nobild_kml_head[x]);
+	}
+	output += "];\n";
+
+	JavaScriptVariable(output, "kml_tail", nobild_kml_tail);
+
+	output += "function kml_station(title, lat, lon) {\n";
+	output += "return '<Placemark><name>' + xml_escape(title) + '</name><styleUrl>#waypoint</styleUrl>"
+	    "<Point><coordinates>' + lon + ',' + lat + '</coordinates></Point></Placemark>\\n';\n";
+	output += "}\n";
+}
+
+static void
+NobildPutCoord(nobild_sink &output, int32_t value)
+{
+	const uint32_t frac = (value < 0) ? -(int64_t)value % NOBILD_DEG(1) : value % NOBILD_DEG(1);
+	char buf[16];
+	int len;
+
+	/* exact decimal degrees, without trailing zeros */
+	len = snprintf(buf, sizeof(buf), "%s%d", (value < 0 && value > NOBILD_DEG(-1)) ?
+	    "-" : "", value / NOBILD_DEG(1));
+
+	if (frac != 0) {
+		len += snprintf(buf + len, sizeof(buf) - len, ".%06u", frac);
+		while (buf[len - 1] == '0')
+			len--;
+	}
+	output.append(buf, len);
+}
+
+static void
+NobildRenderTitle(const nobild_store *pstore, const nobild_station *pst, QByteArray &title)
+{
+	title.resize(0);
+
+	if (pst->flags & FLAG_OWNER) {
+		title += NobildOwner2Str(pst->owner).toUtf8();
+		if (pst->name_length != 0)
+			title += ' ';
+	}
+	title.append(pstore->text(pst->name_offset), pst->name_length);
+
+	if (pst->capacity_max != 0) {
+		title += ' ';
+		title += QByteArray::number(pst->capacity_min / NOBILD_KW(1));
+		if (pst->capacity_min != pst->capacity_max) {
+			title += '-';
+			title += QByteArray::number(pst->capacity_max / NOBILD_KW(1));
+		}
+		title += "kW";
+	}
+	for (int x = 0; x != nobild_type.size(); x++) {
+		if (pst->type[x] == 0)
+			continue;
+		title += ' ';
+		title += NobildType2Str(x).toUtf8();
+		title += ':';
+		title += QByteArray::number(pst->type[x]);
+	}
+	if (!(pst->flags & FLAG_24H))
+		title += " not open 24/7";
+}
+
+/*
+ * The key bitset is written as an array of 32-bit numbers, least
+ * significant first and without trailing zeros, so that the script
+ * can test it without 64-bit integers.
+ */
+static void
+NobildPutKey(nobild_sink &output, uint32_t key)
+{
+	nobild_key bits;
+	int len;
+
+	NobildKeyBits(key, bits);
+
+	for (len = NOBILD_KEY_WORDS * 2; len > 1; len--) {
+		if ((bits.word[(len - 1) / 2] >> (32 * ((len - 1) % 2))) & 0xFFFFFFFFU)
+			break;
+	}
+
+	output += '[';
+	for (int x = 0; x != len; x++) {
+		if (x != 0)
+			output += ',';
+		output += QByteArray::number((uint)(bits.word[x / 2] >> (32 * (x % 2))));
+	}
+	output += ']';
+}
+
+static int32_t
+NobildQuantize(int32_t value)
+{
+	if (value < 0)
+		return (-((NOBILD_COORD_UNIT / 2 - value) / NOBILD_COORD_UNIT));
+	else
+		return ((NOBILD_COORD_UNIT / 2 + value) / NOBILD_COORD_UNIT);
+}
+
+static void
+NobildPutVarint(QByteArray &output, int32_t value)
+{
+	/* zigzag encoding keeps small negative values small */
+	uint32_t temp = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+
+	for (; temp >= 0x80; temp >>= 7)
+		output += (char)(temp | 0x80);
+	output += (char)temp;
+}
+
+/*
+ * The coordinates of a group are stored as latitude and longitude
+ * pairs, each relative to the previous station, in units of
+ * NOBILD_COORD_UNIT microdegrees. The stations are in Morton order
+ * within the group, so the differences are mostly small.
+ */
+static QByteArray
+NobildCoordStream(const nobild_store *pstore, size_t x, size_t end)
+{
+	QByteArray output;
+	int32_t lat = 0;
+	int32_t lon = 0;
+
+	for (; x != end; x++) {
+		const nobild_station *pst = &pstore->pdata[x];
+		const int32_t next_lat = NobildQuantize(pst->lat);
+		const int32_t next_lon = NobildQuantize(pst->lon);
+
+		NobildPutVarint(output, next_lat - lat);
+		NobildPutVarint(output, next_lon - lon);
+		lat = next_lat;
+		lon = next_lon;
+	}
+	return (output.toBase64());
+}
+
+static void
+NobildOutputGroup(const nobild_store *pstore, size_t x, size_t end, nobild_sink &output)
+{
+	const nobild_station *pst = &pstore->pdata[x];
+	const size_t first = x;
+	QByteArray title;
+
+	title.reserve(256);
+
+	output += '[';
+	NobildPutKey(output, pst->sort_key);
+	output += ",[";
+
+	for (; x != end; x++) {
+		pst = &pstore->pdata[x];
+		if (x != first)
+			output += ',';
+		NobildRenderTitle(pstore, pst, title);
+		JavaScriptEscape(output, title.constData(), title.size());
+		if (coord_stream)
+			continue;
+		output += ',';
+		NobildPutCoord(output, pst->lat);
+		output += ',';
+		NobildPutCoord(output, pst->lon);
+	}
+	output += ']';
+
+	if (coord_stream) {
+		output += ",\"";
+		output += NobildCoordStream(pstore, first, end);
+		output += '"';
+	}
+	output += ']';
+}
+
+static void
+NobildOutputStations(const nobild_store *pstore, size_t x, size_t last, nobild_sink &output)
+{
+	QHash<uint64_t, nobild_group> &groups = nobild_groups_next;
+	const size_t first = x;
+	size_t end;
+
+	/*
+	 * The station table is shared by all output formats. The
+	 * stations are sorted, so the key bitset is written only once
+	 * per group, as 32-bit words, followed by a flat list of title,
+	 * latitude and longitude triplets. With -c the list only has
+	 * the titles, and the coordinates follow as a base64 encoded
+	 * stream. The table is valid JSON, so that it can also be
+	 * stored in a separate data file:
+	 */
+	output += "[";
+
+	for (; x != last; x = end) {
+		const uint32_t key = pstore->pdata[x].sort_key;
+		const uint32_t tile = pstore->pdata[x].tile;
+		uint64_t hash = NOBILD_HASH_INIT;
+
+		for (end = x; end != last && pstore->pdata[end].sort_key == key &&
+		     pstore->pdata[end].tile == tile; end++)
+			hash = NobildHashValue(hash, pstore->pdata[end].hash);
+
+		if (x != first)
+			output += ",\n";
+
+		const uint64_t offset = output.total;
+
+		if (daemon_interval == 0) {
+			NobildOutputGroup(pstore, x, end, output);
+		} else {
+			/*
+			 * The group text only depends on the contents of
+			 * its stations, in order. Reuse the text from the
+			 * last refresh when none of them have changed:
+			 */
+			const uint64_t id = ((uint64_t)tile << 32) | key;
+			nobild_group &group = groups[id];
+
+			group = nobild_groups.value(id);
+			if (group.hash != hash || group.text.isEmpty()) {
+				nobild_sink temp;
+
+				NobildOutputGroup(pstore, x, end, temp);
+				group.hash = hash;
+				group.text = temp.buffer;
+			}
+			output += group.text;
+		}
+
+		if (stats_mode != STATS_NONE) {
+			nobild_group_stats gs;
+
+			gs.key = key;
+			gs.stations = end - x;
+			gs.bytes = output.total - offset;
+			stats.groups.append(gs);
+		}
+	}
+
+	output += "]\n";
+}
+
+static int
+NobildStr2Tag(const QChar *ptr, int len)
+{
+	for (int x = 1; x != TAG_MAX; x++) {
+		const char *pname = nobild_tag_name[x];
+		int y;
+
+		for (y = 0; y != len; y++) {
+			int ch = ptr[y].unicode();
+
+			if (ch >= 'A' && ch <= 'Z')
+				ch += 'a' - 'A';
+			if (ch != pname[y])
+				break;
+		}
+		if (y == len && pname[y] == 0)
+			return (x);
+	}
+	return (TAG_UNKNOWN);
+}
+
+static int
+NobildParseNext(int state, int tag)
+{
+	switch (state) {
+	case STATE_NONE:
+		if (tag == TAG_CHARGERSTATIONS)
+			return (STATE_ROOT);
+		break;
+	case STATE_ROOT:
+		if (tag == TAG_CHARGERSTATION)
+			return (STATE_STATION);
+		break;
+	case STATE_STATION:
+		if (tag == TAG_METADATA)
+			return (STATE_METADATA);
+		else if (tag == TAG_ATTRIBUTES)
+			return (STATE_ATTRIBUTES);
+		break;
+	case STATE_METADATA:
+		if (tag == TAG_ID || tag == TAG_POSITION || tag == TAG_NAME ||
+		    tag == TAG_OWNED_BY || tag == TAG_USER_COMMENT)
+			return (STATE_TEXT);
+		break;
+	case STATE_ATTRIBUTES:
+		if (tag == TAG_STATION)
+			return (STATE_STATION_LIST);
+		else if (tag == TAG_CONNECTORS)
+			return (STATE_CONNECTORS);
+		break;
+	case STATE_STATION_LIST:
+		if (tag == TAG_ATTRIBUTE)
+			return (STATE_STATION_ATTR);
+		break;
+	case STATE_CONNECTORS:
+		if (tag == TAG_CONNECTOR)
+			return (STATE_CONNECTOR);
+		break;
+	case STATE_CONNECTOR:
+		if (tag == TAG_ATTRIBUTE)
+			return (STATE_CONNECTOR_ATTR);
+		break;
+	case STATE_STATION_ATTR:
+	case STATE_CONNECTOR_ATTR:
+		if (tag == TAG_ATTRTYPEID || tag == TAG_ATTRVALID ||
+		    tag == TAG_TRANS)
+			return (STATE_TEXT);
+		break;
+	default:
+		break;
+	}
+	return (STATE_SKIP);
+}
+
+static QString *
+NobildParseText(nobild_parse &ps, int tag)
+{
+	switch (tag) {
+	case TAG_ID:
+		return (&ps.id);
+	case TAG_POSITION:
+		return (&ps.position);
+	case TAG_NAME:
+		return (&ps.name);
+	case TAG_OWNED_BY:
+		return (&ps.owned_by);
+	case TAG_USER_COMMENT:
+		return (&ps.user_comment);
+	case TAG_ATTRTYPEID:
+		return (&ps.attrtypeid);
+	case TAG_ATTRVALID:
+		return (&ps.attrvalid);
+	case TAG_TRANS:
+		return (&ps.trans);
+	default:
+		return (NULL);
+	}
+}
+
+static uint32_t
+NobildStoreText(nobild_store *pstore, const char *ptr, size_t len, uint16_t &length)
+{
+	const uint32_t offset = pstore->arena.size();
+
+	if (len > UINT16_MAX)
+		len = UINT16_MAX;
+	pstore->arena.append(ptr, len);
+	length = len;
+	return (offset);
+}
+
+static uint32_t
+NobildStoreString(nobild_store *pstore, const QString &str, uint16_t &length)
+{
+	const QByteArray utf8 = str.toUtf8();
+
+	return (NobildStoreText(pstore, utf8.constData(), utf8.size(), length));
+}
+
+static void
+NobildStoreCopy(nobild_store *pstore, const nobild_store *pfrom, const nobild_station *pst)
+{
+	nobild_station *pnew = pstore->alloc();
+
+	*pnew = *pst;
+	pnew->id_offset = NobildStoreText(pstore,
+	    pfrom->text(pst->id_offset), pst->id_length, pnew->id_length);
+	pnew->name_offset = NobildStoreText(pstore,
+	    pfrom->text(pst->name_offset), pst->name_length, pnew->name_length);
+}
+
+static void
+NobildStoreConcat(nobild_store *pstore, const nobild_store *pfrom)
+{
+	const uint32_t base = pstore->arena.size();
+
+	pstore->arena.append(pfrom->arena);
+	pstore->rejected_position += pfrom->rejected_position;
+	pstore->rejected_public += pfrom->rejected_public;
+	pstore->rejected_capacity += pfrom->rejected_capacity;
+
+	for (size_t x = 0; x != pfrom->count; x++) {
+		nobild_station *pnew = pstore->alloc();
+
+		*pnew = pfrom->pdata[x];
+		pnew->id_offset += base;
+		pnew->name_offset += base;
+	}
+}
+
+static inline int
+NobildChar(const QChar &ch)
+{
+	return (ch.unicode());
+}
+
+static inline int
+NobildChar(char ch)
+{
+	return ((uint8_t)ch);
+}
+
+/*
+ * Parses a decimal number into a fixed-point integer with the given
+ * number of decimals, truncating any further decimals. Returns the
+ * number of characters consumed, or zero when there are no digits.
+ * Too large values saturate, so that they fail any range check.
+ */
+template <typename T> static int
+NobildParseFixed(const T *ptr, int len, int decimals, const char *sep, int64_t &value)
+{
+	const int64_t limit = 1000000000000LL;
+	bool negative = false;
+	int digits = 0;
+	int x = 0;
+
+	value = 0;
+
+	if (x != len && NobildChar(ptr[x]) == '-') {
+		negative = true;
+		x++;
+	}
+
+	for (; x != len; x++) {
+		const int ch = NobildChar(ptr[x]);
+
+		if (ch < '0' || ch > '9')
+			break;
+		if (value < limit)
+			value = value * 10 + (ch - '0');
+		digits++;
+	}
+
+	if (x != len && NobildChar(ptr[x]) != 0 && strchr(sep, NobildChar(ptr[x])) != NULL) {
+		for (x++; x != len; x++) {
+			const int ch = NobildChar(ptr[x]);
+
+			if (ch < '0' || ch > '9')
+				break;
+			if (decimals > 0 && value < limit) {
+				value = value * 10 + (ch - '0');
+				decimals--;
+			}
+			digits++;
+		}
+	}
+
+	if (digits == 0)
+		return (0);
+
+	for (; decimals > 0 && value < limit; decimals--)
+		value *= 10;
+	if (negative)
+		value = -value;
+	return (x);
+}
+
+static bool
+NobildParsePosition(const QString &str, int32_t &lat, int32_t &lon)
+{
+	const QChar *ptr = str.constData();
+	const int len = str.size();
+	int64_t value[2];
+	int x = 0;
+
+	/* the position is given as "(latitude,longitude)" */
+	for (int y = 0; y != 3; y++) {
+		while (x != len && ptr[x] == ' ')
+			x++;
+		if (x == len || ptr[x] != "(,)"[y])
+			return (false);
+		x++;
+		if (y == 2)
+			break;
+		while (x != len && ptr[x] == ' ')
+			x++;
+
+		const int n = NobildParseFixed(ptr + x, len - x, 6, ".", value[y]);
+
+		if (n == 0)
+			return (false);
+		x += n;
+	}
+
+	while (x != len && ptr[x] == ' ')
+		x++;
+
+	if (x != len || value[0] < NOBILD_DEG(-90) || value[0] > NOBILD_DEG(90) ||
+	    value[1] < NOBILD_DEG(-180) || value[1] > NOBILD_DEG(180))
+		return (false);
+
+	lat = value[0];
+	lon = value[1];
+	return (true);
+}
+
+static void
+NobildParseStation(nobild_parse &ps, nobild_store *pstore)
+{
+	QString name;
+	uint8_t flags = 0;
+	int32_t lat;
+	int32_t lon;
+	bool valid;
+	int owner;
+
+	/* reuse unchanged stations from the last refresh */
+	if (daemon_interval != 0 && !ps.id.isEmpty()) {
+		const size_t index = nobild_prev_index.value(ps.id, SIZE_MAX);
+
+		if (index != SIZE_MAX && nobild_prev.pdata[index].hash == ps.hash) {
+			NobildStoreCopy(pstore, &nobild_prev, &nobild_prev.pdata[index]);
+			return;
+		}
+	}
+
+	owner = NobildStr2Owner(ps.owned_by);
+	if (owner == owner_other) {
+		owner = NobildStr2Owner(ps.name);
+		if (owner == owner_other)
+			owner = NobildStr2Owner(ps.user_comment);
+	}
+
+	valid = NobildParsePosition(ps.position, lat, lon);
+
+	if (valid && ps.opt_public) {
+		/*
+		 * Only the structured fields are stored. The title is
+		 * rendered from these by NobildRenderTitle() at output.
+		 */
+		if (owner == owner_other && !ps.name.isEmpty()) {
+			int strip = ps.name.indexOf(',');
+			if (strip > -1)
+				name = ps.name.left(strip).trimmed();
+			else
+				name = ps.name;
+		} else if (!ps.name.isEmpty()) {
+			int strip = ps.name.indexOf(',');
+			if (strip > -1)
+				name = ps.name.left(strip).trimmed();
+			else
+				name = ps.name.trimmed();
+
+			if (NobildStr2Owner(name) == owner_other)
+				flags |= FLAG_OWNER;
+		} else {
+			flags |= FLAG_OWNER;
+		}
+
+		if (ps.opt_24h)
+			flags |= FLAG_24H;
+
+		nobild_station *pst = pstore->alloc();
+
+		pst->hash = ps.hash;
+		pst->id_offset = NobildStoreString(pstore, ps.id, pst->id_length);
+		pst->name_offset = NobildStoreString(pstore, name, pst->name_length);
+		pst->flags = flags;
+		pst->lat = lat;
+		pst->lon = lon;
+		pst->owner = owner;
+		pst->capacity_min = ps.opt_capacity_min;
+		pst->capacity_max = ps.opt_capacity_max;
+		for (int z = 0; z != NOBILD_TYPE_MAX; z++)
+			pst->type[z] = (ps.opt_type[z] > UINT16_MAX) ? UINT16_MAX : ps.opt_type[z];
+		pst->sort_key = NobildKey(pst);
+		pst->tile = 0;
+	} else if (!valid) {
+		pstore->rejected_position++;
+	} else {
+		pstore->rejected_public++;
+	}
+}
+
+static void
+NobildParseStationAttr(nobild_parse &ps)
+{
+	ps.attrtypeid = ps.attrtypeid.trimmed();
+	ps.attrvalid = ps.attrvalid.trimmed();
+
+	if (ps.attrtypeid == "24" && ps.attrvalid == "1")
+		ps.opt_24h = 1;
+	else if (ps.attrtypeid == "2" && ps.attrvalid == "1")
+		ps.opt_public = 1;
+}
+
+static void
+NobildParseConnectorAttr(nobild_parse &ps, nobild_store *pstore)
+{
+	ps.attrtypeid = ps.attrtypeid.trimmed();
+
+	if (ps.attrtypeid == "5") {
+		const QChar *ptr = ps.trans.constData();
+		int end = ps.trans.indexOf("kW");
+		int start;
+		int64_t value;
+
+		/* the capacity is the number in front of the unit */
+		while (end > 0 && ptr[end - 1] == ' ')
+			end--;
+		for (start = end; start > 0 && (ptr[start - 1].isDigit() ||
+		     ptr[start - 1] == ',' || ptr[start - 1] == '.'); start--)
+			;
+
+		if (end <= 0 || start == end)
+			;
+		else if (NobildParseFixed(ptr + start, end - start, 1, ",.", value) != end - start ||
+		    value > UINT16_MAX)
+			pstore->rejected_capacity++;
+		else if (value == 0)
+			;
+		else if (ps.opt_capacity_min == 0)
+			ps.opt_capacity_min = ps.opt_capacity_max = value;
+		else if (value < ps.opt_capacity_min)
+			ps.opt_capacity_min = value;
+		else if (value > ps.opt_capacity_max)
+			ps.opt_capacity_max = value;
+	} else if (ps.attrtypeid == "4") {
+		ps.opt_type[NobildStr2Type(ps.trans)]++;
+	}
+}
+
+static double
+NobildTime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1000000000.0);
+}
+
+static double
+NobildCPUTime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1000000000.0);
+}
+
+static void
+NobildStatsStart(double *pt)
+{
+	pt[0] = NobildTime();
+	pt[1] = NobildCPUTime();
+}
+
+static void
+NobildStatsStop(int phase, const double *pt)
+{
+	stats.wall[phase] += NobildTime() - pt[0];
+	stats.cpu[phase] += NobildCPUTime() - pt[1];
+}
+
+static void
+NobildParseBegin(nobild_parse &ps, int tag)
+{
+	int state;
+
+	ps.ptext = NULL;
+
+	/* ignore unknown subtrees */
+	if (ps.skip != 0) {
+		ps.skip++;
+		return;
+	}
+
+	state = NobildParseNext(ps.state[ps.si], tag);
+
+	if (state == STATE_SKIP || ps.si == NOBILD_MAX_TAGS - 1) {
+		ps.skip++;
+		return;
+	}
+	ps.state[++ps.si] = state;
+
+	switch (state) {
+	case STATE_STATION:
+		ps.hash = NOBILD_HASH_INIT;
+		ps.id = QString();
+		ps.position = QString();
+		ps.name = QString();
+		ps.owned_by = QString();
+		ps.user_comment = QString();
+		memset(ps.opt_type, 0, sizeof(ps.opt_type));
+		ps.opt_24h = 0;
+		ps.opt_public = 0;
+		ps.opt_capacity_min = 0;
+		ps.opt_capacity_max = 0;
+		break;
+	case STATE_STATION_ATTR:
+	case STATE_CONNECTOR_ATTR:
+		ps.attrtypeid = QString();
+		ps.attrvalid = QString();
+		ps.trans = QString();
+		break;
+	case STATE_TEXT:
+		ps.ptext = NobildParseText(ps, tag);
+		ps.hash = NobildHashValue(ps.hash, 0x10000 | tag);
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+NobildParseChars(nobild_parse &ps, const QChar *ptr, int len)
+{
+	if (ps.ptext == NULL)
+		return;
+	*ps.ptext += QString::fromRawData(ptr, len);
+	ps.hash = NobildHashString(ps.hash, ptr, len);
+}
+
+static void
+NobildParseEnd(nobild_parse &ps, nobild_store *pstore)
+{
+	ps.ptext = NULL;
+
+	if (ps.skip != 0) {
+		ps.skip--;
+		return;
+	}
+	if (ps.si == 0)
+		return;
+
+	switch (ps.state[ps.si--]) {
+	case STATE_STATION:
+		NobildParseStation(ps, pstore);
+		break;
+	case STATE_STATION_ATTR:
+		NobildParseStationAttr(ps);
+		break;
+	case STATE_CONNECTOR_ATTR:
+		NobildParseConnectorAttr(ps, pstore);
+		break;
+	default:
+		break;
+	}
+}
+
+static int
+NobildParseXML(nobild_parse &ps, nobild_store *pstore)
+{
+	QXmlStreamReader &xml = ps.xml;
+
+	while (1) {
+		QXmlStreamReader::TokenType token = xml.readNext();
+
+		switch (token) {
+		case QXmlStreamReader:: Invalid:
+			if (xml.error() == QXmlStreamReader::PrematureEndOfDocumentError)
+				return (EAGAIN);	/* need more data */
+			return (EINVAL);
+		case QXmlStreamReader:: EndDocument:
+			return (0);
+		case QXmlStreamReader:: Characters:
+			NobildParseChars(ps, xml.text().data(), xml.text().size());
+			break;
+		case QXmlStreamReader:: StartElement:
+			NobildParseBegin(ps,
+			    NobildStr2Tag(xml.name().data(), xml.name().size()));
+			break;
+		case QXmlStreamReader:: EndElement:
+			NobildParseEnd(ps, pstore);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/*
+ * The JSON datadump has the same structure as the XML datadump, except
+ * that some objects have shorter names, and that lists are keyed by
+ * attribute or connector number instead of being tagged.
+ */
+static const struct {
+	const char *name;
+	int tag;
+} nobild_json_alias[] = {
+	{ "csmd", TAG_METADATA },
+	{ "attr", TAG_ATTRIBUTES },
+	{ "st", TAG_STATION },
+	{ "conn", TAG_CONNECTORS },
+};
+
+static int
+NobildJSONKey(const char *ptr, size_t len)
+{
+	for (size_t x = 0; x != sizeof(nobild_json_alias) / sizeof(nobild_json_alias[0]); x++) {
+		if (strlen(nobild_json_alias[x].name) == len &&
+		    memcmp(nobild_json_alias[x].name, ptr, len) == 0)
+			return (nobild_json_alias[x].tag);
+	}
+
+	for (int x = 1; x != TAG_MAX; x++) {
+		const char *pname = nobild_tag_name[x];
+		size_t y;
+
+		for (y = 0; y != len; y++) {
+			if (tolower((uint8_t)ptr[y]) != pname[y])
+				break;
+		}
+		if (y == len && pname[y] == 0)
+			return (x);
+	}
+	return (TAG_UNKNOWN);
+}
+
+static int
+NobildJSONTag(const nobild_parse &ps)
+{
+	if (ps.skip != 0)
+		return (TAG_UNKNOWN);
+
+	/* list entries are implied by their parent */
+	switch (ps.state[ps.si]) {
+	case STATE_ROOT:
+		return (TAG_CHARGERSTATION);
+	case STATE_STATION_LIST:
+	case STATE_CONNECTOR:
+		return (TAG_ATTRIBUTE);
+	case STATE_CONNECTORS:
+		return (TAG_CONNECTOR);
+	default:
+		return (ps.key);
+	}
+}
+
+static unsigned
+NobildJSONHex(const char *ptr)
+{
+	unsigned value = 0;
+
+	for (int x = 0; x != 4; x++) {
+		const int ch = tolower((uint8_t)ptr[x]);
+
+		value <<= 4;
+		if (ch >= '0' && ch <= '9')
+			value |= ch - '0';
+		else if (ch >= 'a' && ch <= 'f')
+			value |= ch - 'a' + 10;
+	}
+	return (value);
+}
+
+static void
+NobildJSONString(QString &output, const char *ptr, size_t len)
+{
+	QByteArray utf8;
+
+	if (memchr(ptr, '\\', len) == NULL) {
+		output = QString::fromUtf8(ptr, len);
+		return;
+	}
+
+	utf8.reserve(len);
+
+	for (size_t x = 0; x != len; x++) {
+		unsigned ch;
+
+		if (ptr[x] != '\\' || x + 1 == len) {
+			utf8 += ptr[x];
+			continue;
+		}
+		switch (ptr[++x]) {
+		case 'b':
+			utf8 += '\b';
+			continue;
+		case 'f':
+			utf8 += '\f';
+			continue;
+		case 'n':
+			utf8 += '\n';
+			continue;
+		case 'r':
+			utf8 += '\r';
+			continue;
+		case 't':
+			utf8 += '\t';
+			continue;
+		case 'u':
+			break;
+		default:
+			utf8 += ptr[x];
+			continue;
+		}
+
+		if (len - x < 5)
+			break;
+		ch = NobildJSONHex(ptr + x + 1);
+		x += 4;
+
+		/* combine surrogate pairs */
+		if (ch >= 0xD800 && ch < 0xDC00 && len - x >= 7 &&
+		    ptr[x + 1] == '\\' && ptr[x + 2] == 'u') {
+			const unsigned low = NobildJSONHex(ptr + x + 3);
+
+			if (low >= 0xDC00 && low < 0xE000) {
+				ch = 0x10000 + ((ch & 0x3FF) << 10) + (low & 0x3FF);
+				x += 6;
+			}
+		}
+
+		if (ch < 0x80) {
+			utf8 += (char)ch;
+		} else if (ch < 0x800) {
+			utf8 += (char)(0xC0 | (ch >> 6));
+			utf8 += (char)(0x80 | (ch & 0x3F));
+		} else if (ch < 0x10000) {
+			utf8 += (char)(0xE0 | (ch >> 12));
+			utf8 += (char)(0x80 | ((ch >> 6) & 0x3F));
+			utf8 += (char)(0x80 | (ch & 0x3F));
+		} else {
+			utf8 += (char)(0xF0 | (ch >> 18));
+			utf8 += (char)(0x80 | ((ch >> 12) & 0x3F));
+			utf8 += (char)(0x80 | ((ch >> 6) & 0x3F));
+			utf8 += (char)(0x80 | (ch & 0x3F));
+		}
+	}
+	output = QString::fromUtf8(utf8);
+}
+
+static void
+NobildJSONValue(nobild_parse &ps, nobild_store *pstore,
+    const char *ptr, size_t len, bool is_string)
+{
+	/* a value is an element which only contains text */
+	NobildParseBegin(ps, NobildJSONTag(ps));
+	ps.key = TAG_UNKNOWN;
+
+	if (ps.ptext != NULL) {
+		QString str;
+
+		if (is_string)
+			NobildJSONString(str, ptr, len);
+		else if (len != 4 || memcmp(ptr, "null", 4) != 0)
+			str = QString::fromLatin1(ptr, len);
+		NobildParseChars(ps, str.constData(), str.size());
+	}
+	NobildParseEnd(ps, pstore);
+}
+
+static int
+NobildParseJSONBuffer(nobild_parse &ps, nobild_store *pstore,
+    const char *ptr, size_t len, size_t &done)
+{
+	size_t x = 0;
+	size_t end;
+
+	while (1) {
+		while (x != len && isspace((uint8_t)ptr[x]))
+			x++;
+
+		/* incomplete tokens are parsed again with more data */
+		done = x;
+		if (x == len)
+			return (EAGAIN);
+
+		switch (ptr[x]) {
+		case '{':
+		case '[':
+			x++;
+			/* the outermost object is not an element */
+			if (ps.depth++ != 0)
+				NobildParseBegin(ps, NobildJSONTag(ps));
+			ps.key = TAG_UNKNOWN;
+			break;
+		case '}':
+		case ']':
+			x++;
+			if (ps.depth == 0)
+				return (EINVAL);
+			if (--ps.depth == 0) {
+				done = x;
+				return (0);
+			}
+			NobildParseEnd(ps, pstore);
+			break;
+		case ',':
+		case ':':
+			x++;
+			break;
+		case '"':
+			for (end = x + 1; end < len && ptr[end] != '"'; end++) {
+				if (ptr[end] == '\\')
+					end++;
+			}
+			if (end >= len)
+				return (EAGAIN);
+
+			/* a string followed by a colon is a key */
+			size_t y;
+			for (y = end + 1; y != len && isspace((uint8_t)ptr[y]); y++)
+				;
+			if (y == len)
+				return (EAGAIN);
+
+			if (ptr[y] == ':') {
+				ps.key = NobildJSONKey(ptr + x + 1, end - x - 1);
+				x = y + 1;
+			} else {
+				if (ps.depth == 0)
+					return (EINVAL);
+				NobildJSONValue(ps, pstore, ptr + x + 1, end - x - 1, true);
+				x = end + 1;
+			}
+			break;
+		default:
+			/* numbers and literals */
+			for (end = x; end != len && (isalnum((uint8_t)ptr[end]) ||
+			    ptr[end] == '-' || ptr[end] == '+' || ptr[end] == '.'); end++)
+				;
+			if (end == len)
+				return (EAGAIN);
+			if (end == x || ps.depth == 0)
+				return (EINVAL);
+			NobildJSONValue(ps, pstore, ptr + x, end - x, false);
+			x = end;
+			break;
+		}
+	}
+}
+
+static int
+NobildParseJSON(nobild_parse &ps, nobild_store *pstore, const QByteArray &data)
+{
+	QByteArray buffer;
+	size_t done = 0;
+	int error;
+
+	/*
+	 * The data is shared, not copied, unless an incomplete value
+	 * is left over from the last call. Then the data is appended
+	 * to it.
+	 */
+	if (ps.json.isEmpty()) {
+		buffer = data;
+	} else {
+		ps.json.append(data);
+		buffer.swap(ps.json);
+	}
+
+	error = NobildParseJSONBuffer(ps, pstore,
+	    buffer.constData(), buffer.size(), done);
+
+	if (error == EAGAIN)
+		ps.json = QByteArray(buffer.constData() + done, buffer.size() - done);
+	return (error);
+}
+
+static int
+NobildParseData(nobild_parse &ps, nobild_store *pstore, const QByteArray &data)
+{
+	double pt[2];
+	int error;
+
+	NobildStatsStart(pt);
+
+	if (input_format == FORMAT_JSON) {
+		error = NobildParseJSON(ps, pstore, data);
+	} else {
+		ps.xml.addData(data);
+		error = NobildParseXML(ps, pstore);
+	}
+
+	NobildStatsStop(PHASE_PARSE, pt);
+	return (error);
+}
+
+static int
+NobildFindRecord(const QByteArray &data, int offset)
+{
+	static const char tag[] = "<chargerstation";
+
+	while ((offset = data.indexOf(tag, offset)) > -1) {
+		int next = offset + (int)sizeof(tag) - 1;
+
+		if (next == data.size())
+			break;
+		if (data[next] == '>' || data[next] == '/' || isspace((uint8_t)data[next]))
+			return (offset);
+		offset = next;
+	}
+	return (-1);
+}
+
+static void *
+NobildParseChunk(void *arg)
+{
+	nobild_chunk *pk = (nobild_chunk *)arg;
+	nobild_parse ps;
+
+	/* feed one piece at a time, so that the data is not copied */
+	ps.xml.addData(pk->prefix);
+	pk->error = NobildParseXML(ps, &pk->store);
+	if (pk->error != EAGAIN)
+		return (NULL);
+
+	ps.xml.addData(pk->data);
+	pk->error = NobildParseXML(ps, &pk->store);
+	if (pk->error != EAGAIN || pk->suffix.isEmpty())
+		return (NULL);
+
+	ps.xml.addData(pk->suffix);
+	pk->error = NobildParseXML(ps, &pk->store);
+	return (NULL);
+}
+
+static int
+NobildParseParallel(const QByteArray &data, nobild_store *pstore)
+{
+	nobild_chunk chunk[NOBILD_MAX_THREADS];
+	int start[NOBILD_MAX_THREADS + 1];
+	int tail;
+	int num = 0;
+	int error = 0;
+
+	/*
+	 * The datadump is a flat list of independent chargerstation
+	 * records. Split the data at record boundaries and wrap each
+	 * range with the document prologue and the closing root tag,
+	 * so that it can be parsed on its own:
+	 */
+	start[0] = NobildFindRecord(data, 0);
+	tail = data.lastIndexOf("</");
+
+	if (start[0] < 0 || tail < start[0]) {
+		nobild_parse ps;
+
+		ps.xml.addData(data);
+		return (NobildParseXML(ps, pstore));
+	}
+
+	for (int x = 1; x != num_threads; x++) {
+		int offset = NobildFindRecord(data,
+		    start[0] + (int)((int64_t)(tail - start[0]) * x / num_threads));
+
+		if (offset < 0)
+			break;
+		if (offset <= start[num])
+			continue;
+		start[++num] = offset;
+	}
+	start[++num] = data.size();
+
+	for (int x = 0; x != num; x++) {
+		chunk[x].prefix = QByteArray::fromRawData(data.constData(), start[0]);
+		chunk[x].data = QByteArray::fromRawData(data.constData() + start[x],
+		    start[x + 1] - start[x]);
+		if (x != num - 1) {
+			chunk[x].suffix = QByteArray::fromRawData(
+			    data.constData() + tail, data.size() - tail);
+		}
+		chunk[x].error = 0;
+
+		if (pthread_create(&chunk[x].td, 0, &NobildParseChunk, &chunk[x]))
+			err(EX_SOFTWARE, "Cannot create parser thread");
+	}
+
+	/* merge the results in the original order */
+	for (int x = 0; x != num; x++) {
+		pthread_join(chunk[x].td, NULL);
+
+		if (chunk[x].error != 0 && error == 0)
+			error = chunk[x].error;
+		NobildStoreConcat(pstore, &chunk[x].store);
+		chunk[x].store.clear();
+	}
+	return (error);
+}
+
+static void
+NobildSortPass(nobild_store *pstore, uint32_t nobild_station::*pkey, int shift, size_t max)
+{
+	size_t *start;
+	nobild_station *pdata;
+
+	start = new size_t [max + 1];
+	memset(start, 0, sizeof(start[0]) * (max + 1));
+
+	/* stable counting sort, which is linear in the number of stations */
+	for (size_t x = 0; x != pstore->count; x++)
+		start[((pstore->pdata[x].*pkey >> shift) % max) + 1]++;
+	for (size_t x = 0; x != max; x++)
+		start[x + 1] += start[x];
+
+	pdata = (nobild_station *)malloc(sizeof(pdata[0]) * pstore->count);
+	if (pdata == NULL)
+		errx(EX_SOFTWARE, "Out of memory");
+
+	for (size_t x = 0; x != pstore->count; x++)
+		pdata[start[(pstore->pdata[x].*pkey >> shift) % max]++] = pstore->pdata[x];
+
+	free(pstore->pdata);
+	pstore->pdata = pdata;
+	pstore->max = pstore->count;
+
+	delete [] start;
+}
+
+static uint32_t
+NobildTileColumns(void)
+{
+	return (ceil(360.0 / tile_size));
+}
+
+static uint32_t
+NobildTileMax(void)
+{
+	return (ceil(180.0 / tile_size) * NobildTileColumns());
+}
+
+static uint32_t
+NobildTile(const nobild_station *pst)
+{
+	const uint32_t cols = NobildTileColumns();
+	const uint32_t rows = NobildTileMax() / cols;
+	int row = floor((pst->lat + NOBILD_DEG(90)) / (tile_size * NOBILD_DEG(1)));
+	int col = floor((pst->lon + NOBILD_DEG(180)) / (tile_size * NOBILD_DEG(1)));
+
+	if (row < 0)
+		row = 0;
+	else if (row >= (int)rows)
+		row = rows - 1;
+	if (col < 0)
+		col = 0;
+	else if (col >= (int)cols)
+		col = cols - 1;
+
+	return (row * cols + col);
+}
+
+static uint32_t
+NobildMorton(const nobild_station *pst)
+{
+	const uint32_t lat = ((int64_t)pst->lat + NOBILD_DEG(90)) * 0xFFFF / NOBILD_DEG(180);
+	const uint32_t lon = ((int64_t)pst->lon + NOBILD_DEG(180)) * 0xFFFF / NOBILD_DEG(360);
+	uint32_t key = 0;
+
+	/* interleave the bits, so that nearby stations get nearby keys */
+	for (int x = 0; x != 16; x++) {
+		key |= ((lon >> x) & 1) << (2 * x);
+		key |= ((lat >> x) & 1) << (2 * x + 1);
+	}
+	return (key);
+}
+
+static int
+NobildCompareTile(const void *a, const void *b)
+{
+	const uint32_t ta = *(const uint32_t *)a;
+	const uint32_t tb = *(const uint32_t *)b;
+
+	return ((ta > tb) - (ta < tb));
+}
+
+/*
+ * Sorts the stations by tile. Only a small part of all tiles is in
+ * use, so the tiles are first numbered in order, to keep the counting
+ * sort small also for small tile sizes.
+ */
+static void
+NobildSortTile(nobild_store *pstore)
+{
+	QHash<uint32_t, uint32_t> rank;
+	QVector<uint32_t> used;
+
+	for (size_t x = 0; x != pstore->count; x++) {
+		const uint32_t tile = pstore->pdata[x].tile;
+
+		if (!rank.contains(tile)) {
+			rank.insert(tile, 0);
+			used.append(tile);
+		}
+	}
+
+	qsort(used.data(), used.size(), sizeof(used[0]), &NobildCompareTile);
+
+	for (int x = 0; x != used.size(); x++)
+		rank[used[x]] = x;
+	for (size_t x = 0; x != pstore->count; x++)
+		pstore->pdata[x].tile = rank.value(pstore->pdata[x].tile);
+
+	NobildSortPass(pstore, &nobild_station::tile, 0, used.size());
+
+	for (size_t x = 0; x != pstore->count; x++)
+		pstore->pdata[x].tile = used[pstore->pdata[x].tile];
+}
+
+static void
+NobildSortXML(nobild_store *pstore)
+{
+	if (tile_size != 0) {
+		for (size_t x = 0; x != pstore->count; x++)
+			pstore->pdata[x].tile = NobildTile(&pstore->pdata[x]);
+	}
+
+	if (pstore->count <= 1)
+		return;
+
+	/* the Morton key is the inner key, so sort it first */
+	if (coord_stream) {
+		for (size_t x = 0; x != pstore->count; x++)
+			pstore->pdata[x].morton = NobildMorton(&pstore->pdata[x]);
+
+		NobildSortPass(pstore, &nobild_station::morton, 0, 0x10000);
+		NobildSortPass(pstore, &nobild_station::morton, 16, 0x10000);
+	}
+
+	NobildSortPass(pstore, &nobild_station::sort_key, 0, key_max);
+
+	/* the tile is the outer key, so sort it last */
+	if (tile_size != 0)
+		NobildSortTile(pstore);
+}
+
+static QString
+NobildTileFile(uint32_t tile)
+{
+	const QFileInfo info(data_file);
+
+	return (QString("%1.%2.%3").arg(info.completeBaseName())
+	    .arg(tile).arg(info.suffix()));
+}
+
+static int
+NobildOutputTiles(const nobild_store *pstore, nobild_sink &index)
+{
+	const QString path = QFileInfo(data_file).path();
+	const uint32_t cols = NobildTileColumns();
+	size_t end;
+
+	/*
+	 * Each tile is written to its own data file, and the index
+	 * lists the bounding box, file name and number of stations of
+	 * every tile, so that only the tiles in view are downloaded:
+	 */
+	index += "[";
+
+	for (size_t x = 0; x != pstore->count; x = end) {
+		const uint32_t tile = pstore->pdata[x].tile;
+		const double lat = (tile / cols) * tile_size - 90.0;
+		const double lon = (tile % cols) * tile_size - 180.0;
+
+		for (end = x; end != pstore->count &&
+		     pstore->pdata[end].tile == tile; end++)
+			;
+
+		QSaveFile file(path + "/" + NobildTileFile(tile));
+
+		if (!file.open(QFile::WriteOnly | QFile::Truncate))
+			return (EINVAL);
+
+		nobild_sink data(&file);
+
+		NobildOutputStations(pstore, x, end, data);
+		data.flush();
+		stats.output_bytes += data.total;
+
+		if (data.error)
+			return (data.error);
+		if (!file.commit())
+			return (EIO);
+
+		if (x != 0)
+			index += ",\n";
+		index += QString("[%1,%2,%3,%4,%5,").arg(tile).arg(lat).arg(lon)
+		    .arg(lat + tile_size).arg(lon + tile_size);
+		JavaScriptEscape(index, NobildTileFile(tile));
+		index += QString(",%1]").arg(end - x);
+	}
+
+	index += "]\n";
+	return (0);
+}
+
+static void
+NobildRetain(nobild_store *pstore)
+{
+	/* keep the stations for the next refresh, by station id */
+	nobild_prev.swap(*pstore);
+	nobild_prev_index.clear();
+
+	for (size_t x = 0; x != nobild_prev.count; x++) {
+		const nobild_station *pst = &nobild_prev.pdata[x];
+		const QString id = QString::fromUtf8(
+		    nobild_prev.text(pst->id_offset), pst->id_length);
+
+		if (!id.isEmpty() && !nobild_prev_index.contains(id))
+			nobild_prev_index.insert(id, x);
+	}
+	pstore->clear();
+}
+
+static void
+NobildCleanupPrev(void)
+{
+	/* stations which have not been reused are no longer needed */
+	nobild_prev.clear();
+	nobild_prev_index.clear();
+}
+
+/* names and links from the rules may contain any character */
+static QString
+NobildHTMLEscape(const QString &str)
+{
+	QString retval;
+
+	for (int x = 0; x != str.size(); x++) {
+		switch (str[x].unicode()) {
+		case '&':
+			retval += "&amp;";
+			break;
+		case '<':
+			retval += "&lt;";
+			break;
+		case '>':
+			retval += "&gt;";
+			break;
+		case '"':
+			retval += "&quot;";
+			break;
+		case '\'':
+			retval += "&#39;";
+			break;
+		default:
+			retval += str[x];
+			break;
+		}
+	}
+	return (retval);
+}
+
+static QString
+NobildDimLabel(int dim, int choice, size_t count)
+{
+	switch (dim) {
+	case DIM_OWNER:
+		return ("<a href=\"" + NobildHTMLEscape(NobildOwner2Link(choice)) + "\">" +
+		    NobildHTMLEscape(NobildOwner2Str(choice)) +
+		    QString(" (%1 stations)</a>").arg(count));
+	case DIM_KW:
+		return (QString("[%1 .. %2] kW (%3 stations)")
+		    .arg(NobildKWBound(choice)).arg(NobildKWBound(choice + 1)).arg(count));
+	case DIM_TYPE:
+		return ("<a href=\"" + NobildHTMLEscape(NobildType2Link(choice)) + "\">" +
+		    NobildHTMLEscape(NobildType2StrFull(choice)) +
+		    QString(" (%1 plugs)</a>").arg(count));
+	default:
+		return (QString("%1 (%2 stations)")
+		    .arg(choice ? "Not open 24/7" : "Open 24/7").arg(count));
+	}
+}
+
+static int
+NobildOutputJS(const nobild_store *pstore)
+{
+	QVector<size_t> count[DIM_MAX];
+	size_t owner_total = 0;
+	int32_t lat_min = NOBILD_DEG(90);
+	int32_t lat_max = NOBILD_DEG(-90);
+	int32_t lon_min = NOBILD_DEG(180);
+	int32_t lon_max = NOBILD_DEG(-180);
+
+	for (int d = 0; d != DIM_MAX; d++)
+		count[d].fill(0, nobild_dims[d].choices);
+
+	for (size_t y = 0; y != pstore->count; y++) {
+		const nobild_station *pst = &pstore->pdata[y];
+
+		owner_total++;
+
+		/* plug types count plugs, the others stations */
+		for (int d = 0; d != DIM_MAX; d++) {
+			for (int x = 0; x != nobild_dims[d].choices; x++) {
+				if (NobildKeyChoice(pst->sort_key, d, x))
+					count[d][x] += (d == DIM_TYPE) ? pst->type[x] : 1;
+			}
+		}
+
+		if (pst->lat < lat_min)
+			lat_min = pst->lat;
+		if (pst->lat > lat_max)
+			lat_max = pst->lat;
+		if (pst->lon < lon_min)
+			lon_min = pst->lon;
+		if (pst->lon > lon_max)
+			lon_max = pst->lon;
+	}
+
+	/* the region defaults to the area covered by all stations */
+	if (lat_min > lat_max) {
+		lat_min = NOBILD_DEG(-90);
+		lat_max = NOBILD_DEG(90);
+		lon_min = NOBILD_DEG(-180);
+		lon_max = NOBILD_DEG(180);
+	}
+
+	nobild_groups_next.clear();
+
+	/* write the data before the loader referring to it */
+	if (!data_file.isEmpty()) {
+		QSaveFile file(data_file);
+
+		if (!file.open(QFile::WriteOnly | QFile::Truncate))
+			return (EINVAL);
+
+		nobild_sink data(&file);
+		int error = 0;
+
+		if (tile_size != 0)
+			error = NobildOutputTiles(pstore, data);
+		else
+			NobildOutputStations(pstore, 0, pstore->count, data);
+		data.flush();
+		stats.output_bytes += data.total;
+
+		if (error == 0)
+			error = data.error;
+		if (error == 0 && !file.commit())
+			error = EIO;
+		if (error != 0)
+			return (error);
+	}
+
+	/* the files replace the old ones only when completely written */
+	QSaveFile file(output_file);
+
+	if (!file.open(QFile::WriteOnly | QFile::Truncate))
+		return (EINVAL);
+
+	nobild_sink js(&file);
+
+	/* the form is written as a string literal, escaped like all text */
+	QString form;
+
+	form += "<form id=\"mainForm\" name=\"mainForm\">";
+
+	form += QString("<h2>Make a selection among %1 EV charging stations</h2>").arg(owner_total);
+
+	form += "<table style=\"width:100%\">";
+	form += "<tr>";
+	for (int d = 0; d != DIM_MAX; d++) {
+		form += QString("<th><div align=\"left\"><b>%1</b></div></th>")
+		    .arg(nobild_dims[d].title);
+	}
+	form += "<th><div align=\"left\"><b>Select icon</b></div></th>";
+	form += "<th><div align=\"left\"><b>Select region</b></div></th>";
+	form += "</tr>";
+	form += "<tr>";
+
+	for (int d = 0; d != DIM_MAX; d++) {
+		form += "<th>";
+		form += "<div align=\"left\"><div align=\"top\">";
+		for (int x = 0; x != nobild_dims[d].choices; x++) {
+			form += QString("<input type=\"checkbox\" name=\"%1_%2\" checked/> %3<br>")
+			    .arg(nobild_dims[d].name).arg(x).arg(NobildDimLabel(d, x, count[d][x]));
+		}
+		form += "</div></div>";
+		form += "</th>";
+	}
+	form += "<th>";
+	form += "<div align=\"left\"><div align=\"top\">";
+	for (int x = 0; x != ICON_MAX; x++) {
+		form += "<div align=\"left\">";
+		form += QString("<input type=\"radio\" name=\"icon\" value=\"%1\"%2>").arg(x).arg((x == 0) ? " checked" : "");
+		form += "</input><img src=\"";
+		form += NobildHTMLEscape(icon_url[x]);
+		form += "\"></img>";
+		form += "</div><br>";
+	}
+	form += "</div></div>";
+	form += "</th>";
+	form += "<th>";
+	form += "<div align=\"left\"><div align=\"top\">";
+	form += QString("Latitude <input type=\"number\" name=\"lat_min\" step=\"any\" value=\"%1\"/>"
+	    " to <input type=\"number\" name=\"lat_max\" step=\"any\" value=\"%2\"/><br>")
+	    .arg(floor(lat_min / (double)NOBILD_DEG(1))).arg(ceil(lat_max / (double)NOBILD_DEG(1)));
+	form += QString("Longitude <input type=\"number\" name=\"lon_min\" step=\"any\" value=\"%1\"/>"
+	    " to <input type=\"number\" name=\"lon_max\" step=\"any\" value=\"%2\"/><br>")
+	    .arg(floor(lon_min / (double)NOBILD_DEG(1))).arg(ceil(lon_max / (double)NOBILD_DEG(1)));
+	form += "</div></div>";
+	form += "</th>";
+	form += "</tr>";
+	form += "</table><br>";
+	form += "<button name=\"btn_gpx\">Download GPX</button> ";
+	form += "<button name=\"btn_kml\">Download KML</button><br>";
+	form += "</form>";
+	js += "document.write(";
+	JavaScriptEscape(js, form);
+	js += ");\n";
+
+	js += "var station_exclude = [];\n";
+	js += "var icon_sel = 0;\n";
+	js += "var lat_min = -90;\n";
+	js += "var lat_max = 90;\n";
+	js += "var lon_min = -180;\n";
+	js += "var lon_max = 180;\n";
+
+	js += "function update_config() {\n";
+	js += "icon_sel = document.mainForm.icon.value;\n";
+	js += "lat_min = parseFloat(document.mainForm.lat_min.value);\n";
+	js += "lat_max = parseFloat(document.mainForm.lat_max.value);\n";
+	js += "lon_min = parseFloat(document.mainForm.lon_min.value);\n";
+	js += "lon_max = parseFloat(document.mainForm.lon_max.value);\n";
+
+	/* collect the bits of all values not selected, see NobildKeyExclude() */
+	js += "station_exclude = [";
+	for (int x = 0; x != NOBILD_KEY_WORDS * 2; x++)
+		js += (x != 0) ? ",0" : "0";
+	js += "];\n";
+	for (int d = 0; d != DIM_MAX; d++) {
+		const nobild_dim &dim = nobild_dims[d];
+
+		if (dim.set) {
+			js += QString("var %1_mask = 0;\n").arg(dim.name);
+			for (int x = 0; x != dim.choices; x++) {
+				js += QString("if (document.mainForm.%1_%2.checked) %1_mask |= %3;\n")
+				    .arg(dim.name).arg(x).arg(1 << x);
+			}
+			js += QString("for (var x = 0; x != %1; x++) {\n").arg(dim.values);
+			js += QString("	if (!(x & %1_mask))\n").arg(dim.name);
+			js += QString("		station_exclude[(x + %1) >> 5] |= 1 << ((x + %1) & 31);\n").arg(dim.offset);
+			js += "}\n";
+		} else {
+			for (int x = 0; x != dim.choices; x++) {
+				js += QString("if (!document.mainForm.%1_%2.checked) station_exclude[%3] |= 1 << %4;\n")
+				    .arg(dim.name).arg(x).arg((dim.offset + x) / 32).arg((dim.offset + x) % 32);
+			}
+		}
+	}
+	js += "}\n";
+
+	/* downloads are not made from incomplete data */
+	if (!data_file.isEmpty()) {
+		js += "function load_failed() {\n";
+		js += "alert('Could not load the charging stations, please try again.');\n";
+		js += "}\n";
+	}
+
+	if (data_file.isEmpty()) {
+		js += "var station_parts = ";
+		NobildOutputStations(pstore, 0, pstore->count, js);
+		js += ";\n";
+		js += "function load_stations(done) {\n";
+		js += "done();\n";
+		js += "}\n";
+	} else if (tile_size != 0) {
+		/* only the tiles overlapping the selected region are fetched */
+		js += "var station_parts = [];\n";
+		js += "var station_tiles = null;\n";
+		js += "var station_loaded = {};\n";
+		js += "var station_loading = {};\n";
+		js += "var station_url = new URL(";
+		JavaScriptEscape(js, QFileInfo(data_file).fileName());
+		js += ", document.currentScript.src).href;\n";
+		js += "function load_json(url, done) {\n";
+		js += "var req = new XMLHttpRequest();\n";
+		js += "req.open('GET', url);\n";
+		js += "req.responseType = 'json';\n";
+		js += "req.onload = function() {\n";
+		js += "	done((req.status == 200) ? req.response : null);\n";
+		js += "};\n";
+		js += "req.onerror = function() {\n";
+		js += "	done(null);\n";
+		js += "};\n";
+		js += "req.send();\n";
+		js += "}\n";
+
+		/*
+		 * Downloads needing a tile which is still loading wait for
+		 * it. A tile which fails to load is fetched again on the
+		 * next download.
+		 */
+		js += "function load_tile(t, finish) {\n";
+		js += "if (station_loading[t[0]]) {\n";
+		js += "	station_loading[t[0]].push(finish);\n";
+		js += "	return;\n";
+		js += "}\n";
+		js += "station_loading[t[0]] = [finish];\n";
+		js += "load_json(new URL(t[5], station_url).href, function(r) {\n";
+		js += "	var w = station_loading[t[0]];\n";
+		js += "	station_loading[t[0]] = null;\n";
+		js += "	if (r != null) {\n";
+		js += "		station_loaded[t[0]] = true;\n";
+		js += "		station_parts = station_parts.concat(r);\n";
+		js += "	}\n";
+		js += "	for (var x = 0; x != w.length; x++)\n";
+		js += "		w[x](r != null);\n";
+		js += "});\n";
+		js += "}\n";
+		js += "function load_stations(done) {\n";
+		js += "if (station_tiles == null) {\n";
+		js += "	load_json(station_url, function(r) {\n";
+		js += "		if (r == null) {\n";
+		js += "			load_failed();\n";
+		js += "			return;\n";
+		js += "		}\n";
+		js += "		station_tiles = r;\n";
+		js += "		load_stations(done);\n";
+		js += "	});\n";
+		js += "	return;\n";
+		js += "}\n";
+		js += "var pending = 1;\n";
+		js += "var failed = false;\n";
+		js += "var finish = function(ok) {\n";
+		js += "	if (!ok)\n";
+		js += "		failed = true;\n";
+		js += "	if (--pending != 0)\n";
+		js += "		return;\n";
+		js += "	if (failed)\n";
+		js += "		load_failed();\n";
+		js += "	else\n";
+		js += "		done();\n";
+		js += "};\n";
+		js += "for (var x = 0; x != station_tiles.length; x++) {\n";
+		js += "	var t = station_tiles[x];\n";
+		js += "	if (station_loaded[t[0]] ||\n";
+		js += "	    t[1] > lat_max || t[3] < lat_min ||\n";
+		js += "	    t[2] > lon_max || t[4] < lon_min)\n";
+		js += "		continue;\n";
+		js += "	pending++;\n";
+		js += "	load_tile(t, finish);\n";
+		js += "}\n";
+		js += "finish(true);\n";
+		js += "}\n";
+	} else {
+		/* the data file is fetched relative to the loader script */
+		js += "var station_parts = null;\n";
+		js += "var station_url = new URL(";
+		JavaScriptEscape(js, QFileInfo(data_file).fileName());
+		js += ", document.currentScript.src).href;\n";
+		js += "function load_stations(done) {\n";
+		js += "if (station_parts != null) {\n";
+		js += "	done();\n";
+		js += "	return;\n";
+		js += "}\n";
+		js += "var req = new XMLHttpRequest();\n";
+		js += "req.open('GET', station_url);\n";
+		js += "req.responseType = 'json';\n";
+		js += "req.onload = function() {\n";
+		js += "	if (req.status != 200 || req.response == null) {\n";
+		js += "		load_failed();\n";
+		js += "		return;\n";
+		js += "	}\n";
+		js += "	station_parts = req.response;\n";
+		js += "	done();\n";
+		js += "};\n";
+		js += "req.onerror = function() {\n";
+		js += "	load_failed();\n";
+		js += "};\n";
+		js += "req.send();\n";
+		js += "}\n";
+	}
+
+	NobildOutputXMLEscape(js);
+	NobildOutputGPXTemplate(js);
+	NobildOutputKMLTemplate(js);
+
+	js += "var icon_url = [\n";
+	for (int x = 0; x != ICON_MAX; x++) {
+		JavaScriptEscape(js, icon_url[x]);
+		js += ",\n";
+	}
+	js += "];\n";
+
+	if (coord_stream) {
+		/* expand the coordinate stream into the triplet list, once */
+		js += "function station_decode(p) {\n";
+		js += "var b = atob(p[2]);\n";
+		js += "var s = [];\n";
+		js += "var v = [0, 0];\n";
+		js += "for (var x = 0, y = 0; x != p[1].length; x++) {\n";
+		js += "	for (var z = 0; z != 2; z++) {\n";
+		js += "		var n = 0;\n";
+		js += "		for (var shift = 0, c = 128; c & 128; shift += 7) {\n";
+		js += "			c = b.charCodeAt(y++);\n";
+		js += "			n |= (c & 127) << shift;\n";
+		js += "		}\n";
+		js += "		v[z] += (n >>> 1) ^ -(n & 1);\n";
+		js += "	}\n";
+		js += QString("	s.push(p[1][x], v[0] / %1, v[1] / %1);\n")
+		    .arg(NOBILD_DEG(1) / NOBILD_COORD_UNIT);
+		js += "}\n";
+		js += "p[1] = s;\n";
+		js += "p.length = 2;\n";
+		js += "}\n";
+	}
+
+	js += "function select_parts(output, fmt) {\n";
+	js += "for (var x = 0; x != station_parts.length; x++) {\n";
+	js += "var p = station_parts[x];\n";
+	js += "var m = 0;\n";
+	js += "for (var y = 0; y != p[0].length; y++)\n";
+	js += "	m |= p[0][y] & station_exclude[y];\n";
+	js += "if (m)\n";
+	js += "	continue;\n";
+	if (coord_stream)
+		js += "if (p.length > 2)\n	station_decode(p);\n";
+	js += "var s = p[1];\n";
+	js += "var str = '';\n";
+	js += "for (var y = 0; y != s.length; y += 3) {\n";
+	js += "	if (s[y + 1] < lat_min || s[y + 1] > lat_max ||\n";
+	js += "	    s[y + 2] < lon_min || s[y + 2] > lon_max)\n";
+	js += "		continue;\n";
+	js += "	str += fmt(s[y], s[y + 1], s[y + 2]);\n";
+	js += "}\n";
+	js += "output.push(str);\n";
+	js += "}\n";
+	js += "}\n";
+
+	js += "document.mainForm.btn_gpx.onclick = function(){\n";
+	js += "update_config();\n";
+	js += "load_stations(function() {\n";
+	js += "var gpx_string = [gpx_head];\n";
+	js += "select_parts(gpx_string, gpx_station);\n";
+	js += "gpx_string.push(gpx_tail);\n";
+
+	js += "var gpx_blob = new Blob(gpx_string, { type: \"application/x-gpx+xml\" });\n";
+	js += "var a = document.createElement('a');\n";
+	js += "a.href = window.URL.createObjectURL(gpx_blob);\n";
+	js += "a.download = 'ev_charging_stations.gpx';\n";
+	js += "a.click();\n";
+	js += "});\n";
+	js += "return false;\n";
+	js += "}\n";
+
+	js += "document.mainForm.btn_kml.onclick = function(){\n";
+	js += "update_config();\n";
+	js += "load_stations(function() {\n";
+	js += "var icon = icon_url[icon_sel];\n";
+	js += "var kml_string = [kml_head[0], icon, kml_head[1], icon, kml_head[2]];\n";
+	js += "select_parts(kml_string, kml_station);\n";
+	js += "kml_string.push(kml_tail);\n";
+
+	js += "var kml_blob = new Blob(kml_string, { type: \"application/vnd.google-earth.kml+xml\" });\n";
+
+	js += "var a = document.createElement('a');\n";
+	js += "a.href = window.URL.createObjectURL(kml_blob);\n";
+	js += "a.download = 'ev_charging_stations.kml';\n";
+	js += "a.click();\n";
+	js += "});\n";
+	js += "return false;\n";
+	js += "}\n";
+
+	js.flush();
+	stats.output_bytes += js.total;
+
+	if (js.error != 0)
+		return (js.error);
+	if (!file.commit())
+		return (EIO);
+
+	if (daemon_interval != 0)
+		nobild_groups.swap(nobild_groups_next);
+
+	return (0);
+}
+
+static int
+NobildParseFile(const QString &name, nobild_store *pstore, QCryptographicHash &hash)
+{
+	nobild_parse ps;
+	QFile file;
+	int error = EAGAIN;
+
+	if (name == "-") {
+		if (!file.open(stdin, QFile::ReadOnly))
+			return (EINVAL);
+	} else {
+		file.setFileName(name);
+
+		if (!file.open(QFile::ReadOnly))
+			return (EINVAL);
+
+		qint64 size = file.size();
+		uchar *ptr = (size > 0) ? file.map(0, size) : NULL;
+
+		if (ptr != NULL) {
+			/* parse directly from the mapping, without copying */
+			QByteArray data = QByteArray::fromRawData((const char *)ptr, size);
+
+			hash.addData(data);
+			stats.input_bytes += data.size();
+
+			if (num_threads > 1 && input_format == FORMAT_XML) {
+				double pt[2];
+
+				NobildStatsStart(pt);
+				error = NobildParseParallel(data, pstore);
+				NobildStatsStop(PHASE_PARSE, pt);
+			} else {
+				error = NobildParseData(ps, pstore, data);
+			}
+			file.unmap(ptr);
+			return (error);
+		}
+	}
+
+	/* not mappable, like stdin or a FIFO */
+	while (error == EAGAIN) {
+		QByteArray data = file.read(NOBILD_READ_SIZE);
+
+		if (data.isEmpty())
+			break;
+		hash.addData(data);
+		stats.input_bytes += data.size();
+		error = NobildParseData(ps, pstore, data);
+	}
+	return (error);
+}
+
+static int
+NobildFetchXML(nobild_store *pstore, QCryptographicHash &hash,
+    QByteArray &last_modified, QByteArray &etag)
+{
+	QNetworkAccessManager manager;
+	QNetworkRequest request(QUrl(fetch_url.isEmpty() ?
+	    QString("http://nobil.no/api/server/datadump.php?apikey=%1&format=%2&file=false")
+	    .arg(apikey).arg(input_format == FORMAT_JSON ? "json" : "xml") :
+	    fetch_url));
+	QNetworkReply *reply;
+	QEventLoop loop;
+	QTimer timer;
+	nobild_parse ps;
+	int error = EAGAIN;
+	int status = 0;
+
+#if (QT_VERSION >= 0x050600) && (QT_VERSION < 0x060000)
+	request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
+#endif
+	/*
+	 * The Accept-Encoding header is left to the network access
+	 * manager, which then requests a compressed transfer and
+	 * decompresses the reply transparently.
+	 */
+	if (!fetch_etag.isEmpty())
+		request.setRawHeader("If-None-Match", fetch_etag);
+	if (!fetch_modified.isEmpty())
+		request.setRawHeader("If-Modified-Since", fetch_modified);
+
+	reply = manager.get(request);
+
+	QObject::connect(reply, SIGNAL(readyRead()), &loop, SLOT(quit()));
+	QObject::connect(reply, SIGNAL(finished()), &loop, SLOT(quit()));
+	QObject::connect(&timer, SIGNAL(timeout()), &loop, SLOT(quit()));
+
+	timer.setSingleShot(true);
+
+	/* parse the datadump while it is being downloaded */
+	while (1) {
+		timer.start(fetch_timeout * 1000);
+		loop.exec();
+
+		if (status == 0) {
+			status = reply->attribute(
+			    QNetworkRequest::HttpStatusCodeAttribute).toInt();
+		}
+
+		QByteArray data = reply->readAll();
+
+		if (status == 200 && error == EAGAIN && !data.isEmpty()) {
+			hash.addData(data);
+			stats.input_bytes += data.size();
+			error = NobildParseData(ps, pstore, data);
+		}
+
+		if (reply->isFinished())
+			break;
+
+		/* no data has arrived within the timeout */
+		if (!timer.isActive() && data.isEmpty()) {
+			reply->abort();
+			delete reply;
+			return (ETIMEDOUT);
+		}
+	}
+
+	if (reply->error() != QNetworkReply::NoError) {
+		error = EIO;
+	} else if (status == 304) {
+		error = EALREADY;
+	} else if (status != 200) {
+		error = EIO;
+	} else if (error == 0) {
+		last_modified = reply->rawHeader("Last-Modified");
+		etag = reply->rawHeader("ETag");
+	}
+	delete reply;
+	return (error);
+}
+
+/*
+ * Synthetic datadump, for benchmarking without an API key. The owner
+ * and connector mixes roughly follow the real datadump.
+ */
+static const struct {
+	const char *owned_by;
+	const char *name;
+	unsigned weight;
+} nobild_gen_owner[] = {
+	{ "Fortum Charge and Drive Norway AS", "Fortum", 14 },
+	{ "Mer Norway AS", "Mer", 12 },
+	{ "Eviny Elektrifisering AS", "Eviny", 6 },
+	{ "Clever A/S", "Clever", 4 },
+	{ "E.ON Drive Norway AS", "E.ON", 3 },
+	{ "Tesla Motors Norway AS", "Tesla Supercharger", 8 },
+	{ "IONITY GmbH", "IONITY", 3 },
+	{ "BEE Norway AS", "BEE", 2 },
+	{ "Circle K Norge AS", "Circle K", 8 },
+	{ "Kommune", "Parkering", 40 },
+};
+
+static const struct {
+	const char *type;
+	const char *capacity;
+	unsigned weight;
+} nobild_gen_connector[] = {
+	{ "Type 2", "22 kW - 400V 3-phase max 32A", 40 },
+	{ "Type 2", "7,4 kW - 230V 1-phase max 32A", 15 },
+	{ "CCS/Combo", "50 kW - 500VDC max 125A", 12 },
+	{ "CCS/Combo", "150 kW DC", 10 },
+	{ "CCS/Combo", "350 kW DC", 4 },
+	{ "CHAdeMO", "50 kW - 500VDC max 125A", 8 },
+	{ "Tesla Connector Model S", "120 kW DC", 3 },
+	{ "Schuko CEE 7/4", "3,6 kW - 230V 1-phase max 16A", 8 },
+};
+
+static uint32_t
+NobildRandom(uint64_t &seed)
+{
+	/* xorshift64*, so that the datadump is the same on every run */
+	seed ^= seed >> 12;
+	seed ^= seed << 25;
+	seed ^= seed >> 27;
+	return ((seed * 2685821657736338717ULL) >> 32);
+}
+
+template <typename T, size_t N> static unsigned
+NobildGeneratePick(uint64_t &seed, const T (&table)[N])
+{
+	unsigned total = 0;
+	unsigned value;
+	unsigned x;
+
+	for (x = 0; x != N; x++)
+		total += table[x].weight;
+
+	value = NobildRandom(seed) % total;
+
+	for (x = 0; value >= table[x].weight; x++)
+		value -= table[x].weight;
+	return (x);
+}
+
+static void
+NobildGenerateAttr(nobild_sink &output, bool first, int attrtypeid,
+    const char *attrname, int attrvalid, const char *trans)
+{
+	if (input_format == FORMAT_JSON) {
+		output += QString("%1\"%2\":{\"attrtypeid\":\"%2\",\"attrname\":\"%3\","
+		    "\"attrvalid\":\"%4\",\"trans\":\"%5\"}")
+		    .arg(first ? "" : ",").arg(attrtypeid).arg(attrname)
+		    .arg(attrvalid).arg(trans);
+	} else {
+		output += QString("<attribute><attrtypeid>%1</attrtypeid><attrname>%2</attrname>"
+		    "<attrvalid>%3</attrvalid><trans>%4</trans></attribute>")
+		    .arg(attrtypeid).arg(attrname).arg(attrvalid).arg(trans);
+	}
+}
+
+static int
+NobildGenerate(size_t count)
+{
+	const bool json = (input_format == FORMAT_JSON);
+	uint64_t seed = 0x6e6f62696c64ULL;
+	QFile file;
+
+	if (!file.open(stdout, QFile::WriteOnly))
+		return (EINVAL);
+
+	nobild_sink output(&file);
+
+	if (json)
+		output += "{\"Provider\":\"NOBIL.no\",\"chargerstations\":[\n";
+	else
+		output += "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<chargerstations>\n";
+
+	for (size_t x = 0; x != count; x++) {
+		const unsigned owner = NobildGeneratePick(seed, nobild_gen_owner);
+		const unsigned connectors = (NobildRandom(seed) % 2) ?
+		    1 : 1 + NobildRandom(seed) % 7;
+		const unsigned lat = 58000000 + NobildRandom(seed) % 13000000;
+		const unsigned lon = 5000000 + NobildRandom(seed) % 26000000;
+		const bool is_public = (NobildRandom(seed) % 10) != 0;
+		const bool is_24h = (NobildRandom(seed) % 10) < 7;
+		const QString name = QString("%1 Storgata %2")
+		    .arg(nobild_gen_owner[owner].name).arg(x % 200 + 1);
+		const QString position = QString("(%1.%2,%3.%4)")
+		    .arg(lat / 1000000).arg(lat % 1000000, 6, 10, QChar('0'))
+		    .arg(lon / 1000000).arg(lon % 1000000, 6, 10, QChar('0'));
+
+		if (json) {
+			output += QString("%1{\"csmd\":{\"id\":%2,\"name\":\"%3\",\"Owned_by\":\"%4\","
+			    "\"Position\":\"%5\",\"User_comment\":\"\"},\"attr\":{\"st\":{")
+			    .arg(x ? ",\n" : "").arg(x + 1).arg(name)
+			    .arg(nobild_gen_owner[owner].owned_by).arg(position);
+		} else {
+			output += QString("<chargerstation><metadata><id>%1</id><name>%2</name>"
+			    "<Owned_by>%3</Owned_by><Position>%4</Position><User_comment></User_comment>"
+			    "</metadata><attributes><station>")
+			    .arg(x + 1).arg(name).arg(nobild_gen_owner[owner].owned_by).arg(position);
+		}
+
+		NobildGenerateAttr(output, true, 2, "Availability",
+		    is_public ? 1 : 2, is_public ? "Public" : "Visitors");
+		NobildGenerateAttr(output, false, 24, "Open 24h",
+		    is_24h ? 1 : 2, is_24h ? "Yes" : "No");
+
+		output += json ? "},\"conn\":{" : "</station><connectors>";
+
+		for (unsigned y = 0; y != connectors; y++) {
+			const unsigned conn = NobildGeneratePick(seed, nobild_gen_connector);
+
+			if (json)
+				output += QString("%1\"%2\":{").arg(y ? "," : "").arg(y + 1);
+			else
+				output += "<connector>";
+			NobildGenerateAttr(output, true, 4, "Connector",
+			    conn + 1, nobild_gen_connector[conn].type);
+			NobildGenerateAttr(output, false, 5, "Charging capacity",
+			    conn + 1, nobild_gen_connector[conn].capacity);
+			output += json ? "}" : "</connector>";
+		}
+		output += json ? "}}}" : "</connectors></attributes></chargerstation>\n";
+	}
+
+	output += json ? "\n]}\n" : "</chargerstations>\n";
+	output.flush();
+
+	return (output.error);
+}
+
+static void
+NobildXMLEscape(nobild_sink &output, const QByteArray &input)
+{
+	const char *ptr = input.constData();
+	int run = 0;
+
+	for (int x = 0; x != input.size(); x++) {
+		const char *esc;
+
+		switch (ptr[x]) {
+		case '&':
+			esc = "&amp;";
+			break;
+		case '<':
+			esc = "&lt;";
+			break;
+		case '>':
+			esc = "&gt;";
+			break;
+		case '"':
+			esc = "&quot;";
+			break;
+		default:
+			continue;
+		}
+		output.append(ptr + run, x - run);
+		output += esc;
+		run = x + 1;
+	}
+	output.append(ptr + run, input.size() - run);
+}
 
-static QString icon_url[ICON_MAX] = {
-	"http://www.selasky.org/charging/gfx_map_symbol_low.png",
-	"http://www.selasky.org/charging/gfx_map_symbol_blue_low.png"
-};
+static void
+NobildPutLE(nobild_sink &output, uint64_t value, int bytes)
+{
+	while (bytes--) {
+		output += (char)(value & 0xFF);
+		value >>= 8;
+	}
+}
 
-static int
-NobildStr2Owner(const QString & str)
-{
-	QString upper = str.toUpper();
-
-	if (upper.startsWith("BEE "))
-		return (OWNER_BEE);
-	else if (upper.startsWith("EVINY ") || upper.startsWith("BKK "))
-		return (OWNER_BKK);
-	else if (upper.indexOf("CLEVER") > -1)
-		return (OWNER_CLEVER);
-	else if (upper.indexOf("E.ON") > -1)
-		return (OWNER_EON);
-	else if (upper.indexOf("FORTUM") > -1 || upper.startsWith("RECHARGE "))
-		return (OWNER_FORTUM);
-	else if (upper.indexOf("GRØNN KONTAKT") > -1 || upper.startsWith("MER "))
-		return (OWNER_GRONNKONTAKT);
-	else if (upper.indexOf("TESLA") > -1)
-		return (OWNER_TESLA);
-	else if (upper.indexOf("IONITY") > -1)
-		return (OWNER_IONITY);
-	else
-		return (OWNER_OTHER);
+void
+nobild_emit_gpx::header(const nobild_store *)
+{
+	output += nobild_gpx_head;
 }
 
-static	QString
-NobildOwner2Str(int value)
+void
+nobild_emit_gpx::station(const nobild_store *, const nobild_station *pst, const QByteArray &title)
 {
-	switch (value) {
-	case OWNER_BEE:
-		return ("Bee");
-	case OWNER_BKK:
-		return ("Eviny");
-	case OWNER_CLEVER:
-		return ("Clever");
-	case OWNER_EON:
-		return ("E.ON");
-	case OWNER_FORTUM:
-		return ("Recharge");
-	case OWNER_GRONNKONTAKT:
-		return ("Mer");
-	case OWNER_TESLA:
-		return ("Tesla");
-	case OWNER_IONITY:
-		return ("Ionity");
-	default:
-		return ("Other");
+	output += "<wpt lat=\"";
+	NobildPutCoord(output, pst->lat);
+	output += "\" lon=\"";
+	NobildPutCoord(output, pst->lon);
+	output += "\"><name>";
+	NobildXMLEscape(output, title);
+	output += "</name></wpt>\n";
+}
+
+void
+nobild_emit_gpx::footer(const nobild_store *)
+{
+	output += nobild_gpx_tail;
+}
+
+void
+nobild_emit_kml::header(const nobild_store *)
+{
+	output += nobild_kml_head[0];
+	output += icon_url[0];
+	output += nobild_kml_head[1];
+	output += icon_url[0];
+	output += nobild_kml_head[2];
+}
+
+void
+nobild_emit_kml::station(const nobild_store *, const nobild_station *pst, const QByteArray &title)
+{
+	output += "<Placemark><name>";
+	NobildXMLEscape(output, title);
+	output += "</name><styleUrl>#waypoint</styleUrl><Point><coordinates>";
+	NobildPutCoord(output, pst->lon);
+	output += ',';
+	NobildPutCoord(output, pst->lat);
+	output += "</coordinates></Point></Placemark>\n";
+}
+
+void
+nobild_emit_kml::footer(const nobild_store *)
+{
+	output += nobild_kml_tail;
+}
+
+void
+nobild_emit_geojson::header(const nobild_store *)
+{
+	output += "{\"type\":\"FeatureCollection\",\"features\":[\n";
+}
+
+void
+nobild_emit_geojson::station(const nobild_store *, const nobild_station *pst, const QByteArray &title)
+{
+	if (count != 0)
+		output += ",\n";
+	output += "{\"type\":\"Feature\",\"geometry\":{\"type\":\"Point\",\"coordinates\":[";
+	NobildPutCoord(output, pst->lon);
+	output += ',';
+	NobildPutCoord(output, pst->lat);
+	output += "]},\"properties\":{\"title\":";
+	JavaScriptEscape(output, title.constData(), title.size());
+	output += ",\"owner\":";
+	JavaScriptEscape(output, NobildOwner2Str(pst->owner));
+	output += ",\"kw_min\":";
+	output += QByteArray::number(pst->capacity_min / (double)NOBILD_KW(1), 'g', 6);
+	output += ",\"kw_max\":";
+	output += QByteArray::number(pst->capacity_max / (double)NOBILD_KW(1), 'g', 6);
+	output += ",\"plugs\":{";
+	for (int x = 0, y = 0; x != nobild_type.size(); x++) {
+		if (pst->type[x] == 0)
+			continue;
+		if (y++ != 0)
+			output += ',';
+		JavaScriptEscape(output, NobildType2Str(x));
+		output += ':';
+		output += QByteArray::number(pst->type[x]);
 	}
+	output += "},\"open_24h\":";
+	output += (pst->flags & FLAG_24H) ? "true" : "false";
+	output += "}}";
 }
 
-static	QString
-NobildOwner2Link(int value)
+void
+nobild_emit_geojson::footer(const nobild_store *)
 {
-	switch (value) {
-	case OWNER_BEE:
-		return ("https://bee.se");
-	case OWNER_BKK:
-		return ("https://www.eviny.no");
-	case OWNER_CLEVER:
-		return ("https://clever.dk");
-	case OWNER_EON:
-		return ("https://www.eon.com");
-	case OWNER_FORTUM:
-		return ("http://www.rechargeinfra.com");
-	case OWNER_GRONNKONTAKT:
-		return ("https://no.mer.eco");
-	case OWNER_TESLA:
-		return ("https://www.tesla.com");
-	case OWNER_IONITY:
-		return ("https://ionity.eu");
-	default:
-		return ("index.html");
+	output += "\n]}\n";
+}
+
+/* text fields are quoted, and quotes are doubled, as in RFC 4180 */
+static void
+NobildPutCSV(nobild_sink &output, const QByteArray &str)
+{
+	output += '"';
+	output += QByteArray(str).replace('"', "\"\"");
+	output += '"';
+}
+
+void
+nobild_emit_csv::header(const nobild_store *)
+{
+	static const char *const head[] = {
+		"title", "latitude", "longitude", "owner", "kw_min", "kw_max"
+	};
+
+	for (size_t x = 0; x != sizeof(head) / sizeof(head[0]); x++) {
+		if (x != 0)
+			output += ',';
+		NobildPutCSV(output, head[x]);
 	}
+	for (int x = 0; x != nobild_type.size(); x++) {
+		output += ',';
+		NobildPutCSV(output, NobildType2Str(x).toUtf8());
+	}
+	output += ',';
+	NobildPutCSV(output, "open_24h");
+	output += '\n';
 }
 
-static	QString
-NobildType2Str(int value)
+void
+nobild_emit_csv::station(const nobild_store *, const nobild_station *pst, const QByteArray &title)
 {
-	switch (value) {
-	case TYPE_CCS:
-		return ("CCS");
-	case TYPE_CHADEMO:
-		return ("CHA");
-	case TYPE_2:
-		return ("TP2");
-	case TYPE_TESLA:
-		return ("TES");
-	default:
-		return ("UNK");
+	NobildPutCSV(output, title);
+	output += ',';
+	NobildPutCoord(output, pst->lat);
+	output += ',';
+	NobildPutCoord(output, pst->lon);
+	output += ',';
+	NobildPutCSV(output, NobildOwner2Str(pst->owner).toUtf8());
+	output += ',';
+	output += QByteArray::number(pst->capacity_min / (double)NOBILD_KW(1), 'g', 6);
+	output += ',';
+	output += QByteArray::number(pst->capacity_max / (double)NOBILD_KW(1), 'g', 6);
+	for (int x = 0; x != nobild_type.size(); x++) {
+		output += ',';
+		output += QByteArray::number(pst->type[x]);
 	}
+	output += (pst->flags & FLAG_24H) ? ",1\n" : ",0\n";
 }
 
-static	QString
-NobildType2StrFull(int value)
+/*
+ * The binary format is little endian. The header is the magic
+ * "NOBILD\1\0", the number of stations as 32 bits, followed by the
+ * number of owners and plug types, each as 8 bits and followed by
+ * their names, as an 8-bit length and UTF-8 text. Each station then
+ * has the latitude and longitude in microdegrees as signed 32 bits,
+ * the minimum and maximum capacity in units of 0.1 kW as 16 bits, the
+ * owner and the flags as 8 bits, the number of plugs of each type as
+ * 16 bits, and the title as a 16-bit length and UTF-8 text.
+ */
+void
+nobild_emit_binary::header(const nobild_store *pstore)
 {
-	switch (value) {
-	case TYPE_CCS:
-		return ("CCS EUR");
-	case TYPE_CHADEMO:
-		return ("CHAdeMO");
-	case TYPE_2:
-		return ("Type 2");
-	case TYPE_TESLA:
-		return ("Tesla connector");
-	default:
-		return ("Other");
+	output.append("NOBILD\1\0", 8);
+	NobildPutLE(output, pstore->count, 4);
+
+	NobildPutLE(output, nobild_owner.size(), 1);
+	for (int x = 0; x != nobild_owner.size(); x++) {
+		const QByteArray name = NobildOwner2Str(x).toUtf8();
+
+		NobildPutLE(output, name.size(), 1);
+		output += name;
+	}
+
+	NobildPutLE(output, nobild_type.size(), 1);
+	for (int x = 0; x != nobild_type.size(); x++) {
+		const QByteArray name = NobildType2Str(x).toUtf8();
+
+		NobildPutLE(output, name.size(), 1);
+		output += name;
 	}
 }
 
-static	QString
-NobildType2Link(int value)
+void
+nobild_emit_binary::station(const nobild_store *, const nobild_station *pst, const QByteArray &title)
+{
+	NobildPutLE(output, (uint32_t)pst->lat, 4);
+	NobildPutLE(output, (uint32_t)pst->lon, 4);
+	NobildPutLE(output, pst->capacity_min, 2);
+	NobildPutLE(output, pst->capacity_max, 2);
+	NobildPutLE(output, pst->owner, 1);
+	NobildPutLE(output, pst->flags, 1);
+	for (int x = 0; x != nobild_type.size(); x++)
+		NobildPutLE(output, pst->type[x], 2);
+	NobildPutLE(output, title.size(), 2);
+	output += title;
+}
+
+static nobild_emitter *
+NobildEmitterNew(int format, nobild_sink &output)
 {
-	switch (value) {
-	case TYPE_CCS:
-		return ("https://en.wikipedia.org/wiki/Combined_Charging_System");
-	case TYPE_CHADEMO:
-		return ("https://en.wikipedia.org/wiki/CHAdeMO");
-	case TYPE_2:
-		return ("https://en.wikipedia.org/wiki/Type_2_connector");
-	case TYPE_TESLA:
-		return ("https://en.wikipedia.org/wiki/Tesla_Supercharger");
+	switch (format) {
+	case EMIT_GPX:
+		return (new nobild_emit_gpx(output));
+	case EMIT_KML:
+		return (new nobild_emit_kml(output));
+	case EMIT_GEOJSON:
+		return (new nobild_emit_geojson(output));
+	case EMIT_CSV:
+		return (new nobild_emit_csv(output));
 	default:
-		return ("index.html");
+		return (new nobild_emit_binary(output));
 	}
 }
 
 static void
-JavaScriptStringify(QString &output, const QString &variable, const QString &input)
+NobildEmit(const nobild_store *pstore, nobild_emitter **pem, int num)
 {
-	QByteArray ba(input.toUtf8());
+	QByteArray title;
 
-	output += variable;
-	output += ".push(";
+	for (int y = 0; y != num; y++)
+		pem[y]->header(pstore);
 
-	for (int x = 0; x != ba.count(); x++) {
-		int ch = (uint8_t)ba[x];
+	for (size_t x = 0; x != pstore->count; x++) {
+		const nobild_station *pst = &pstore->pdata[x];
 
-		if (x != ba.count() - 1)
-			output += QString("%1,").arg(ch);
-		else
-			output += QString("%1").arg(ch);
+		NobildRenderTitle(pstore, pst, title);
+
+		for (int y = 0; y != num; y++) {
+			pem[y]->station(pstore, pst, title);
+			pem[y]->count++;
+		}
 	}
 
-	output += ");\n";
+	for (int y = 0; y != num; y++)
+		pem[y]->footer(pstore);
 }
 
-static void
-NobildOutputGPXParts(nobild_head_t *phead, QString &output, const QString &variable)
+static int
+NobildOutputEmitters(const nobild_store *pstore)
 {
-	const nobild_cache *pc;
-	int64_t owner_last = 0;
-	int64_t kw_last = 0;
-	int64_t type_last = 0;
-	bool first = true;
+	const int num = emit_format.size();
+	QSaveFile *pfile[EMIT_MAX * 4];
+	nobild_sink *psink[EMIT_MAX * 4];
+	nobild_emitter *pem[EMIT_MAX * 4];
+	int error = 0;
+	int x;
+
+	if (num == 0)
+		return (0);
+
+	for (x = 0; x != num; x++) {
+		pfile[x] = new QSaveFile(emit_file[x]);
+		psink[x] = new nobild_sink(pfile[x]);
+		pem[x] = NobildEmitterNew(emit_format[x], *psink[x]);
 
-	JavaScriptStringify(output, variable,
-	    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
-	    "<gpx xmlns=\"http://www.topografix.com/GPX/1/1\" "
-	    "xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\" "
-	    "xsi:schemaLocation=\"http://www.topografix.com/GPX/1/1 http://www.topografix.com/GPX/1/1/gpx.xsd\" version=\"1.1\" "
-	    "creator=\"Data provided by http://nobil.no and processed by http://www.selasky.org/charging\">\n");
+		if (!pfile[x]->open(QFile::WriteOnly | QFile::Truncate)) {
+			error = EINVAL;
+			x++;
+			break;
+		}
+	}
 
-	TAILQ_FOREACH(pc, phead, entry) {
-		int64_t owner_mask = pc->get_owner_mask();
-		int64_t kw_mask = pc->get_kw_mask();
-		int64_t type_mask = pc->get_type_mask();
+	if (error == 0)
+		NobildEmit(pstore, pem, num);
 
-		if (owner_last != owner_mask || kw_last != kw_mask || type_last != type_mask) {
-			owner_last = owner_mask;
-			kw_last = kw_mask;
-			type_last = type_mask;
+	for (int y = 0; y != x; y++) {
+		psink[y]->flush();
+		stats.output_bytes += psink[y]->total;
+		if (error == 0)
+			error = psink[y]->error;
+	}
 
-			if (first == false)
-				output += "}\n";
-			first = false;
-			output += QString("if ((owner_mask & %1) && (kw_mask & %2) && (type_mask & %3)) {\n")
-			    .arg(owner_mask).arg(kw_mask).arg(type_mask);
-		}
-		JavaScriptStringify(output, variable, pc->output_gpx + QString("\n"));
+	/* replace the old files only when all were written */
+	while (x--) {
+		if (error == 0 && !pfile[x]->commit())
+			error = EIO;
+		delete pem[x];
+		delete psink[x];
+		delete pfile[x];
 	}
-	if (first == false)
-		output += "}\n";
-	JavaScriptStringify(output, variable, "</gpx>\n");
+	return (error);
 }
 
 static void
-NobildOutputKMLIcon(QString &output, const QString &variable, const QString &icon_sel)
+NobildServerUpdate(const nobild_store *pstore)
 {
-	for (int x = 0; x != ICON_MAX - 1; x++) {
-		if (x != 0)
-			output += "else ";
-		output += QString("if (") + icon_sel + QString(" == %1)\n").arg(x);
-		JavaScriptStringify(output, variable, icon_url[x]);
-	}
-	output += "else\n";
-	JavaScriptStringify(output, variable, icon_url[ICON_MAX - 1]);
-}
-
-static void
-NobildOutputKMLParts(nobild_head_t *phead, QString &output, const QString &variable, const QString &icon_sel)
-{
-	const nobild_cache *pc;
-	int64_t owner_last = 0;
-	int64_t kw_last = 0;
-	int64_t type_last = 0;
-	bool first = true;
-
-	JavaScriptStringify(output, variable,
-	    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
-	    "<kml xmlns=\"http://www.opengis.net/kml/2.2\" xmlns:gx=\"http://www.google.com/kml/ext/2.2\">\n"
-	    "<Document>\n"
-	    "<name>EV charging stations</name>\n"
-	    "<snippet>Data provided by http://nobil.no and processed by http://www.selasky.org/charging</snippet>\n"
-	    "<LookAt>\n"
-	    "<longitude>15</longitude>\n"
-	    "<latitude>63</latitude>\n"
-	    "<range>2560000</range>\n"
-	    "</LookAt>\n"
-	    "<Style id=\"waypoint_n\">\n"
-	    "<IconStyle>\n"
-	    "<Icon>\n"
-	    "<href>");
-
-	NobildOutputKMLIcon(output, variable, icon_sel);
-
-	JavaScriptStringify(output, variable,
-	    "</href>\n"
-	    "</Icon>\n"
-	    "</IconStyle>\n"
-	    "</Style>\n"
-	    "<Style id=\"waypoint_h\">\n"
-	    "<IconStyle>\n"
-	    "<scale>1.2</scale>\n"
-	    "<Icon>\n"
-	    "<href>");
-
-	NobildOutputKMLIcon(output, variable, icon_sel);
-
-	JavaScriptStringify(output, variable,
-            "</href>\n"
-	    "</Icon>\n"
-	    "</IconStyle>\n"
-	    "</Style>\n"
-	    "<StyleMap id=\"waypoint\">\n"
-	    "<Pair>\n"
-	    "<key>normal</key>\n"
-	    "<styleUrl>#waypoint_n</styleUrl>\n"
-	    "</Pair>\n"
-	    "<Pair>\n"
-	    "<key>highlight</key>\n"
-	    "<styleUrl>#waypoint_h</styleUrl>\n"
-	    "</Pair>\n"
-	    "</StyleMap>\n"
-	    "<Folder>\n"
-	    "<name>EV charging stations</name>\n");
-
-	TAILQ_FOREACH(pc, phead, entry) {
-		int64_t owner_mask = pc->get_owner_mask();
-		int64_t kw_mask = pc->get_kw_mask();
-		int64_t type_mask = pc->get_type_mask();
-
-		if (owner_last != owner_mask || kw_last != kw_mask || type_last != type_mask) {
-			owner_last = owner_mask;
-			kw_last = kw_mask;
-			type_last = type_mask;
-
-			if (first == false)
-				output += "}\n";
-			first = false;
-			output += QString("if ((owner_mask & %1) && (kw_mask & %2) && (type_mask & %3)) {\n")
-			    .arg(owner_mask).arg(kw_mask).arg(type_mask);
-		}
-		JavaScriptStringify(output, variable, pc->output_kml + QString("\n"));
-	}
-	if (first == false)
-		output += "}\n";
-
-	JavaScriptStringify(output, variable,
-	    "</Folder>\n"
-	    "</Document>\n"
-	    "</kml>\n");
-}
-
-static void
-NobildParseXML(const QByteArray & data, nobild_head_t *phead)
-{
-	QXmlStreamReader:: TokenType token = QXmlStreamReader::NoToken;
-	QXmlStreamReader xml(data);
-	QString tags[NOBILD_MAX_TAGS];
-	QString position;
-	QString name;
-	QString owned_by;
-	QString user_comment;
-	QString attrtypeid;
-	QString attrvalid;
-	QString trans;
-	float opt_capacity_min;
-	float opt_capacity_max;
-	size_t opt_type[TYPE_MAX];
-	int opt_public;
-	int opt_24h;
-	size_t si = 0;
-
-	while (!xml.atEnd()) {
-		if (token == QXmlStreamReader::NoToken)
-			token = xml.readNext();
+	nobild_index *pidx = new nobild_index;
+	nobild_index *pold;
+	nobild_sink gpx;
+	nobild_sink kml;
+	nobild_emit_gpx gpx_emit(gpx);
+	nobild_emit_kml kml_emit(kml);
+	QByteArray title;
+
+	pidx->gpx_offset.reserve(pstore->count + 1);
+	pidx->kml_offset.reserve(pstore->count + 1);
+	pidx->lat.reserve(pstore->count);
+	pidx->lon.reserve(pstore->count);
+
+	for (size_t x = 0; x != pstore->count; x++) {
+		const nobild_station *pst = &pstore->pdata[x];
+
+		if (x == 0 || pst->sort_key != pstore->pdata[x - 1].sort_key) {
+			nobild_index_group group;
+
+			NobildKeyBits(pst->sort_key, group.key);
+			group.first = group.last = x;
+			group.lat_min = group.lat_max = pst->lat;
+			group.lon_min = group.lon_max = pst->lon;
+			pidx->groups.append(group);
+		}
 
-		switch (token) {
-		case QXmlStreamReader:: Invalid:
-			return;
-		case QXmlStreamReader:: StartElement:
-			if (si < NOBILD_MAX_TAGS)
-				tags[si] = xml.name().toString().toLower();
-			si++;
-
-			if (si == 2 &&
-			    tags[0] == "chargerstations" &&
-			    tags[1] == "chargerstation") {
-				position = QString();
-				name = QString();
-				owned_by = QString();
-				user_comment = QString();
-				memset(opt_type, 0, sizeof(opt_type));
-				opt_24h = 0;
-				opt_public = 0;
-				opt_capacity_min = 0;
-				opt_capacity_max = 0;
-			} else if (si == 4 &&
-				   tags[0] == "chargerstations" &&
-				   tags[1] == "chargerstation" &&
-				   tags[2] == "metadata" &&
-				   tags[3] == "position") {
-				token = xml.readNext();
-				if (token != QXmlStreamReader::Characters)
-					continue;
-				position = xml.text().toString();
-			} else if (si == 4 &&
-				   tags[0] == "chargerstations" &&
-				   tags[1] == "chargerstation" &&
-				   tags[2] == "metadata" &&
-				   tags[3] == "name") {
-				token = xml.readNext();
-				if (token != QXmlStreamReader::Characters)
-					continue;
-				name = xml.text().toString();
-			} else if (si == 4 &&
-				   tags[0] == "chargerstations" &&
-				   tags[1] == "chargerstation" &&
-				   tags[2] == "metadata" &&
-				   tags[3] == "owned_by") {
-				token = xml.readNext();
-				if (token != QXmlStreamReader::Characters)
-					continue;
-				owned_by = xml.text().toString();
-			} else if (si == 4 &&
-				   tags[0] == "chargerstations" &&
-				   tags[1] == "chargerstation" &&
-				   tags[2] == "metadata" &&
-				   tags[3] == "user_comment") {
-				token = xml.readNext();
-				if (token != QXmlStreamReader::Characters)
-					continue;
-				user_comment = xml.text().toString();
-			} else if (si == 5 &&
-				   tags[0] == "chargerstations" &&
-				   tags[1] == "chargerstation" &&
-				   tags[2] == "attributes" &&
-				   tags[3] == "station" &&
-				   tags[4] == "attribute") {
-				attrtypeid = QString();
-				attrvalid = QString();
-				trans = QString();
-			} else if (si == 6 &&
-				   tags[0] == "chargerstations" &&
-				   tags[1] == "chargerstation" &&
-				   tags[2] == "attributes" &&
-				   tags[3] == "station" &&
-				   tags[4] == "attribute" &&
-				   tags[5] == "attrtypeid") {
-				token = xml.readNext();
-				if (token != QXmlStreamReader::Characters)
-					continue;
-				attrtypeid = xml.text().toString().trimmed();
-			} else if (si == 6 &&
-				   tags[0] == "chargerstations" &&
-				   tags[1] == "chargerstation" &&
-				   tags[2] == "attributes" &&
-				   tags[3] == "station" &&
-				   tags[4] == "attribute" &&
-				   tags[5] == "attrvalid") {
-				token = xml.readNext();
-				if (token != QXmlStreamReader::Characters)
-					continue;
-				attrvalid = xml.text().toString().trimmed();
-			} else if (si == 6 &&
-				   tags[0] == "chargerstations" &&
-				   tags[1] == "chargerstation" &&
-				   tags[2] == "attributes" &&
-				   tags[3] == "station" &&
-				   tags[4] == "attribute" &&
-				   tags[5] == "trans") {
-				token = xml.readNext();
-				if (token != QXmlStreamReader::Characters)
-					continue;
-				trans = xml.text().toString().trimmed();
-			} else if (si == 6 &&
-				   tags[0] == "chargerstations" &&
-				   tags[1] == "chargerstation" &&
-				   tags[2] == "attributes" &&
-				   tags[3] == "connectors" &&
-				   tags[4] == "connector" &&
-				   tags[5] == "attribute") {
-				attrtypeid = QString();
-				attrvalid = QString();
-				trans = QString();
-			} else if (si == 7 &&
-				   tags[0] == "chargerstations" &&
-				   tags[1] == "chargerstation" &&
-				   tags[2] == "attributes" &&
-				   tags[3] == "connectors" &&
-				   tags[4] == "connector" &&
-				   tags[5] == "attribute" &&
-				   tags[6] == "attrtypeid") {
-				token = xml.readNext();
-				if (token != QXmlStreamReader::Characters)
-					continue;
-				attrtypeid = xml.text().toString().trimmed();
-			} else if (si == 7 &&
-				   tags[0] == "chargerstations" &&
-				   tags[1] == "chargerstation" &&
-				   tags[2] == "attributes" &&
-				   tags[3] == "connectors" &&
-				   tags[4] == "connector" &&
-				   tags[5] == "attribute" &&
-				   tags[6] == "attrvalid") {
-				token = xml.readNext();
-				if (token != QXmlStreamReader::Characters)
-					continue;
-				attrvalid = xml.text().toString().trimmed();
-			} else if (si == 7 &&
-				   tags[0] == "chargerstations" &&
-				   tags[1] == "chargerstation" &&
-				   tags[2] == "attributes" &&
-				   tags[3] == "connectors" &&
-				   tags[4] == "connector" &&
-				   tags[5] == "attribute" &&
-				   tags[6] == "trans") {
-				token = xml.readNext();
-				if (token != QXmlStreamReader::Characters)
-					continue;
-				trans = xml.text().toString().trimmed();
-			}
-			break;
+		nobild_index_group &group = pidx->groups.last();
 
-		case QXmlStreamReader:: EndElement:
-			if (si == 0)
-				break;
+		group.last = x + 1;
+		if (pst->lat < group.lat_min)
+			group.lat_min = pst->lat;
+		if (pst->lat > group.lat_max)
+			group.lat_max = pst->lat;
+		if (pst->lon < group.lon_min)
+			group.lon_min = pst->lon;
+		if (pst->lon > group.lon_max)
+			group.lon_max = pst->lon;
 
-			if (si == 2 &&
-			    tags[0] == "chargerstations" &&
-			    tags[1] == "chargerstation") {
-				QString title;
-				float coord[2] = {};
-				float factor = 1.0;
-				int owner;
-				int x;
-				int offset;
-
-				owner = NobildStr2Owner(owned_by);
-				if (owner == OWNER_OTHER) {
-					owner = NobildStr2Owner(name);
-					if (owner == OWNER_OTHER)
-						owner = NobildStr2Owner(user_comment);
-				}
-
-				for (x = 2, offset = position.size(); x > -1 && offset--;) {
-					if (position[offset].isNumber()) {
-						if (x >= 0 && x < 2) {
-							coord[x] += position[offset].digitValue() * factor;
-							factor *= 10.0;
-						}
-					} else if (position[offset] == '.') {
-						if (x >= 0 && x < 2) {
-							coord[x] /= factor;
-							factor = 1.0;
-						}
-					} else if (position[offset] == '(' || position[offset] == ')' || position[offset] == ',') {
-						x--;
-						factor = 1.0;
-					} else {
-						break;
-					}
-				}
-
-				if (offset == 0 && opt_public && x == -1) {
-					if (owner == OWNER_OTHER && !name.isEmpty()) {
-						int strip = name.indexOf(',');
-						if (strip > -1)
-							title += name.left(strip).trimmed();
-						else
-							title += name;
-					} else if (!name.isEmpty()) {
-						QString tt;
-
-						int strip = name.indexOf(',');
-						if (strip > -1)
-							tt += name.left(strip).trimmed();
-						else
-							tt += name.trimmed();
-
-						if (NobildStr2Owner(tt) == OWNER_OTHER) {
-							title += NobildOwner2Str(owner);
-							title += " ";
-						}
-						title += tt;
-					} else {
-						title += NobildOwner2Str(owner);
-					}
-
-					if (opt_capacity_max != 0.0) {
-						if (opt_capacity_min == opt_capacity_max) {
-							title += QString(" %1kW").arg((int)opt_capacity_min);
-						} else {
-							title += QString(" %1-%2kW")
-							  .arg((int)opt_capacity_min).arg((int)opt_capacity_max);
-						}
-					}
-					for (x = 0; x != TYPE_MAX; x++) {
-						if (opt_type[x] == 0)
-							continue;
-						title += QString(" %1:%2").arg(NobildType2Str(x)).arg(opt_type[x]);
-					}
-					if (!opt_24h)
-						title += " not open 24/7";
-
-					nobild_cache *pc = new nobild_cache;
-
-					pc->output_gpx = QString("<wpt lat=\"%1\" lon=\"%2\"><name>%3</name></wpt>")
-					    .arg(coord[0]).arg(coord[1]).arg(title);
-					pc->output_kml = QString("<Placemark><name>%1</name><styleUrl>#waypoint</styleUrl><Point><coordinates>%2,%3</coordinates></Point></Placemark>")
-					    .arg(title).arg(coord[1]).arg(coord[0]);
-					pc->owner = owner;
-					pc->capacity_min = opt_capacity_min;
-					pc->capacity_max = opt_capacity_max;
-					for (int z = 0; z != TYPE_MAX; z++)
-						pc->type[z] = opt_type[z];
-					TAILQ_INSERT_TAIL(phead, pc, entry);
-				}
-			} else if (si == 5 &&
-				   tags[0] == "chargerstations" &&
-				   tags[1] == "chargerstation" &&
-				   tags[2] == "attributes" &&
-				   tags[3] == "station" &&
-				   tags[4] == "attribute") {
-
-				if (attrtypeid == "24" && attrvalid == "1")
-					opt_24h = 1;
-				else if (attrtypeid == "2" && attrvalid == "1")
-					opt_public = 1;
-			} else if (si == 6 &&
-				   tags[0] == "chargerstations" &&
-				   tags[1] == "chargerstation" &&
-				   tags[2] == "attributes" &&
-				   tags[3] == "connectors" &&
-				   tags[4] == "connector" &&
-				   tags[5] == "attribute") {
-
-				if (attrtypeid == "5") {
-					int offset = trans.indexOf("kW");
-					float factor = 1.0;
-					float capacity = 0.0;
-
-					for (; offset--; ) {
-						if (trans[offset] == ' ') {
-							if (capacity != 0.0)
-								break;
-						} else if (trans[offset] == ',') {
-							capacity /= factor;
-							factor = 1.0;
-						} else if (trans[offset].isNumber()) {
-							capacity += trans[offset].digitValue() * factor;
-							factor *= 10.0;
-						} else {
-							break;
-						}
-					}
-
-					if (capacity == 0.0)
-						;
-					else if (opt_capacity_min == 0.0)
-						opt_capacity_min = opt_capacity_max = capacity;
-					else if (capacity < opt_capacity_min)
-						opt_capacity_min = capacity;
-					else if (capacity > opt_capacity_max)
-						opt_capacity_max = capacity;
-				} else if (attrtypeid == "4") {
-					if (trans.indexOf("CCS") > -1)
-						opt_type[TYPE_CCS]++;
-					else if (trans.indexOf("CHAdeMO") > -1)
-						opt_type[TYPE_CHADEMO]++;
-					else if (trans.indexOf("Type 2") > -1)
-						opt_type[TYPE_2]++;
-					else if (trans.indexOf("Tesla Connector Model") > -1)
-						opt_type[TYPE_TESLA]++;
-					else
-						opt_type[TYPE_OTHER]++;
-				}
-			}
-			si--;
-			if (si < NOBILD_MAX_TAGS)
-				tags[si] = QString();
-			break;
-		default:
-			break;
-		}
-		token = QXmlStreamReader::NoToken;
+		/* only the station fragments are stored */
+		NobildRenderTitle(pstore, pst, title);
+
+		pidx->gpx_offset.append(gpx.total);
+		gpx_emit.station(pstore, pst, title);
+
+		pidx->kml_offset.append(kml.total);
+		kml_emit.station(pstore, pst, title);
+
+		pidx->lat.append(pst->lat);
+		pidx->lon.append(pst->lon);
 	}
+	pidx->gpx_offset.append(gpx.total);
+	pidx->kml_offset.append(kml.total);
+	pidx->gpx = gpx.buffer;
+	pidx->kml = kml.buffer;
+
+	server_mtx.lock();
+	pold = server_index;
+	server_index = pidx;
+	server_mtx.unlock();
+
+	delete pold;
 }
 
-static int
-NobildSortCompare(const void *pa, const void *pb)
-{
-	const nobild_cache *pc_a = *(const nobild_cache **)pa;
-	const nobild_cache *pc_b = *(const nobild_cache **)pb;
-
-	if (pc_a->get_owner_mask() > pc_b->get_owner_mask())
-		return (1);
-	else if (pc_a->get_owner_mask() < pc_b->get_owner_mask())
-		return (-1);
-	else if (pc_a->get_kw_mask() > pc_b->get_kw_mask())
-		return (1);
-	else if (pc_a->get_kw_mask() < pc_b->get_kw_mask())
-		return (-1);
-	else if (pc_a->get_type_mask() > pc_b->get_type_mask())
-		return (1);
-	else if (pc_a->get_type_mask() < pc_b->get_type_mask())
-		return (-1);
+static bool
+NobildQueryMask(const QByteArray &value, int choices, int64_t &mask)
+{
+	bool ok = true;
+
+	if (value.isEmpty())
+		mask = -1LL;
 	else
-		return (0);
+		mask = value.toLongLong(&ok);
+
+	/* ignore bits which do not select anything */
+	mask &= (1LL << choices) - 1;
+	return (ok);
 }
 
-static void
-NobildSortXML(nobild_head_t *phead)
+static bool
+NobildQueryCoord(const QByteArray &value, int64_t &coord)
 {
-	nobild_cache *pc;
-	nobild_cache **ppc;
-	size_t num;
+	return (value.size() != 0 &&
+	    NobildParseFixed(value.constData(), value.size(), 6, ".", coord) == value.size());
+}
 
-	num = 0;
-	TAILQ_FOREACH(pc, phead, entry)
-		num++;
+/*
+ * Parses the percent-encoded query of a download request. Returns
+ * EINVAL when a parameter is malformed. Unknown parameters are
+ * ignored.
+ */
+static int
+NobildQueryParse(const QByteArray &query, nobild_query &q)
+{
+	const QList<QByteArray> list = query.split('&');
+	QByteArray value[DIM_MAX + 2];
+	bool ok = true;
+
+	for (int x = 0; x != list.size(); x++) {
+		const int offset = list[x].indexOf('=');
+		const QByteArray key = QByteArray::fromPercentEncoding(list[x].left(offset));
+		const QByteArray data = (offset < 0) ? QByteArray() :
+		    QByteArray::fromPercentEncoding(list[x].mid(offset + 1));
+
+		for (int d = 0; d != DIM_MAX; d++) {
+			if (key == nobild_dims[d].name)
+				value[d] = data;
+		}
+		if (key == "bbox")
+			value[DIM_MAX] = data;
+		else if (key == "icon")
+			value[DIM_MAX + 1] = data;
+	}
 
-	if (num <= 1)
-		return;
+	for (int d = 0; d != DIM_MAX; d++)
+		ok &= NobildQueryMask(value[d], nobild_dims[d].choices, q.mask[d]);
 
-	ppc = new nobild_cache * [num];
+	/* the bounding box is given as south,west,north,east */
+	q.lat_min = NOBILD_DEG(-90);
+	q.lon_min = NOBILD_DEG(-180);
+	q.lat_max = NOBILD_DEG(90);
+	q.lon_max = NOBILD_DEG(180);
 
-	num = 0;
-	TAILQ_FOREACH(pc, phead, entry)
-		ppc[num++] = pc;
+	if (!value[DIM_MAX].isEmpty()) {
+		const QList<QByteArray> bbox = value[DIM_MAX].split(',');
 
-	mergesort(ppc, num, sizeof(ppc[0]), &NobildSortCompare);
+		ok &= (bbox.size() == 4 &&
+		    NobildQueryCoord(bbox[0], q.lat_min) &&
+		    NobildQueryCoord(bbox[1], q.lon_min) &&
+		    NobildQueryCoord(bbox[2], q.lat_max) &&
+		    NobildQueryCoord(bbox[3], q.lon_max));
+	}
 
-	TAILQ_INIT(phead);
+	/* the icon only applies to KML */
+	q.icon = 0;
+	if (q.kml && !value[DIM_MAX + 1].isEmpty()) {
+		bool valid;
 
-	for (size_t x = 0; x != num; x++)
-		TAILQ_INSERT_TAIL(phead, ppc[x], entry);
+		q.icon = value[DIM_MAX + 1].toInt(&valid);
+		ok &= (valid && q.icon >= 0 && q.icon < ICON_MAX);
+	}
+	return (ok ? 0 : EINVAL);
+}
 
-	delete [] ppc;
+/* the same key for all requests giving the same response */
+static QByteArray
+NobildQueryKey(const nobild_query &q)
+{
+	QByteArray key;
+
+	key += q.kml ? "kml" : "gpx";
+	key += ',';
+	key += QByteArray::number(q.icon);
+	for (int d = 0; d != DIM_MAX; d++) {
+		key += ',';
+		key += QByteArray::number((qlonglong)q.mask[d]);
+	}
+	key += ',';
+	key += QByteArray::number((qlonglong)q.lat_min);
+	key += ',';
+	key += QByteArray::number((qlonglong)q.lon_min);
+	key += ',';
+	key += QByteArray::number((qlonglong)q.lat_max);
+	key += ',';
+	key += QByteArray::number((qlonglong)q.lon_max);
+	return (key);
 }
 
 static void
-NobildCleanup(nobild_head_t *phead)
+NobildServerAppend(QByteArray &body, const QByteArray &blob,
+    const QVector<uint32_t> &offset, size_t first, size_t last)
+{
+	body.append(blob.constData() + offset[first], offset[last] - offset[first]);
+}
+
+static QByteArray
+NobildServerQuery(const nobild_index *pidx, const nobild_query &q)
 {
-	nobild_cache *pc;
+	const bool kml = q.kml;
+	const QByteArray &blob = kml ? pidx->kml : pidx->gpx;
+	const QVector<uint32_t> &offset = kml ? pidx->kml_offset : pidx->gpx_offset;
+	const int64_t lat_min = q.lat_min;
+	const int64_t lon_min = q.lon_min;
+	const int64_t lat_max = q.lat_max;
+	const int64_t lon_max = q.lon_max;
+	nobild_key exclude;
+	QByteArray body;
+
+	NobildKeyExclude(q.mask, exclude);
+
+	if (kml) {
+		const QByteArray url = icon_url[q.icon].toUtf8();
+
+		body += nobild_kml_head[0];
+		body += url;
+		body += nobild_kml_head[1];
+		body += url;
+		body += nobild_kml_head[2];
+	} else {
+		body += nobild_gpx_head;
+	}
+
+	for (int x = 0; x != pidx->groups.size(); x++) {
+		const nobild_index_group &group = pidx->groups[x];
+
+		if (group.key.intersects(exclude))
+			continue;
 
-	while ((pc = TAILQ_FIRST(phead))) {
-		TAILQ_REMOVE(phead, pc, entry);
-		delete pc;
+		/* skip or copy whole groups when possible */
+		if (group.lat_min > lat_max || group.lat_max < lat_min ||
+		    group.lon_min > lon_max || group.lon_max < lon_min)
+			continue;
+
+		if (group.lat_min >= lat_min && group.lat_max <= lat_max &&
+		    group.lon_min >= lon_min && group.lon_max <= lon_max) {
+			NobildServerAppend(body, blob, offset, group.first, group.last);
+			continue;
+		}
+
+		for (size_t y = group.first, end; y != group.last; y = end) {
+			for (end = y; end != group.last &&
+			     pidx->lat[end] >= lat_min && pidx->lat[end] <= lat_max &&
+			     pidx->lon[end] >= lon_min && pidx->lon[end] <= lon_max; end++)
+				;
+			if (end == y)
+				end++;
+			else
+				NobildServerAppend(body, blob, offset, y, end);
+		}
 	}
+
+	body += kml ? nobild_kml_tail : nobild_gpx_tail;
+	return (body);
 }
 
-static int
-NobildOutputJS(nobild_head_t *phead)
+static void
+NobildServerReply(QTcpSocket *sock, const char *status, const char *type, const QByteArray &body)
 {
-	size_t type_max[TYPE_MAX] = {};
-	size_t owner_max[OWNER_MAX] = {};
-	size_t kw_count[KW_MAX] = {};
-	size_t owner_total = 0;
-	nobild_cache *pc;
-	QString js;
+	QByteArray header;
+
+	header += "HTTP/1.0 ";
+	header += status;
+	header += "\r\nContent-Type: ";
+	header += type;
+	header += "\r\nContent-Length: ";
+	header += QByteArray::number(body.size());
+	header += "\r\nCache-Control: max-age=";
+	header += QByteArray::number(daemon_interval ? daemon_interval : 3600);
+	header += "\r\nConnection: close\r\n\r\n";
+
+	/* one request per connection, anything sent after it is ignored */
+	QObject::disconnect(sock, SIGNAL(readyRead()), 0, 0);
+
+	sock->write(header);
+	sock->write(body);
+	sock->disconnectFromHost();
+}
 
-	TAILQ_FOREACH(pc, phead, entry) {
-		owner_max[pc->owner]++;
-		owner_total++;
-		for (int x = 0; x != TYPE_MAX; x++)
-			type_max[x] += pc->type[x];
-
-		for (int x = 0; x != KW_MAX; x++)
-			kw_count[x] += (pc->get_kw_mask() >> x) & 1;
-	}
-
-	js += "document.write(\'";
-	js += "<form id=\"mainForm\" name=\"mainForm\">";
-
-	js += QString("<h2>Make a selection among %1 EV charging stations</h2>").arg(owner_total);
-
-	js += "<table style=\"width:100%\">";
-	js += "<tr>";
-	js += "<th><div align=\"left\"><b>Select power</b></div></th>";
-	js += "<th><div align=\"left\"><b>Select vendor</b></div></th>";
-	js += "<th><div align=\"left\"><b>Select plug</b></div></th>";
-	js += "<th><div align=\"left\"><b>Select icon</b></div></th>";
-	js += "</tr>";
-	js += "<tr>";
-	js += "<th>";
-	js += "<div align=\"left\"><div align=\"top\">";
-
-	for (int x = 0; x != KW_MAX; x++) {
-		js += QString("<input type=\"checkbox\" name=\"kw_%1\" checked/> [%2 .. %3] kW (%4 stations)<br>")
-		    .arg(x).arg((x == 0) ? 0 : (20 << (x - 1))).arg(20 << x).arg(kw_count[x]);
-	}
-	js += "</div></div>";
-	js += "</th>";
-
-	js += "<th>";
-	js += "<div align=\"left\"><div align=\"top\">";
-
-	for (int x = 0; x != OWNER_MAX; x++) {
-		js += QString("<input type=\"checkbox\" name=\"owner_%1\" checked/> <a href=\"%2\">%3 (%4 stations)</a><br>")
-		    .arg(x)
-		    .arg(NobildOwner2Link(x))
-		    .arg(NobildOwner2Str(x))
-		    .arg(owner_max[x]);
-	}
-	js += "</div></div>";
-	js += "</th>";
-
-	js += "<th>";
-	js += "<div align=\"left\"><div align=\"top\">";
-	for (int x = 0; x != TYPE_MAX; x++) {
-		js += QString("<input type=\"checkbox\" name=\"type_%1\" checked/> <a href=\"%2\">%3 (%4 plugs)</a><br>")
-		    .arg(x)
-		    .arg(NobildType2Link(x))
-		    .arg(NobildType2StrFull(x))
-		    .arg(type_max[x]);
-	}
-	js += "</div></div>";
-	js += "</th>";
-	js += "<th>";
-	js += "<div align=\"left\"><div align=\"top\">";
-	for (int x = 0; x != ICON_MAX; x++) {
-		js += "<div align=\"left\">";
-		js += QString("<input type=\"radio\" name=\"icon\" value=\"%1\"%2>").arg(x).arg((x == 0) ? " checked" : "");
-		js += "</input><img src=\"";
-		js += icon_url[x];
-		js += "\"></img>";
-		js += "</div><br>";
-	}
-	js += "</div></div>";
-	js += "</th>";
-	js += "</tr>";
-	js += "</table><br>";
-	js += "<button name=\"btn_gpx\">Download GPX</button> ";
-	js += "<button name=\"btn_kml\">Download KML</button><br>";
-	js += "</form>";
-	js += "\');\n";
-
-	js += "var kw_mask = 0;\n";
-	js += "var owner_mask = 0;\n";
-	js += "var type_mask = 0;\n";
-	js += "var icon_sel = 0;\n";
+void
+nobild_server::handle_connection()
+{
+	while (server.hasPendingConnections()) {
+		QTcpSocket *sock = server.nextPendingConnection();
+		QTimer *ptimer = new QTimer(sock);
+
+		/* connections making no progress are closed */
+		ptimer->setSingleShot(true);
+		ptimer->start(NOBILD_HTTP_TIMEOUT * 1000);
+		timer.insert(sock, ptimer);
+
+		connect(ptimer, SIGNAL(timeout()), this, SLOT(handle_timeout()));
+		connect(sock, SIGNAL(readyRead()), this, SLOT(handle_read()));
+		connect(sock, SIGNAL(bytesWritten(qint64)), this, SLOT(handle_written()));
+		connect(sock, SIGNAL(disconnected()), this, SLOT(handle_disconnect()));
+	}
+}
 
-	js += "function update_config() {\n";
-	js += "kw_mask = 0;\n";
-	js += "owner_mask = 0;\n";
-	js += "type_mask = 0;\n";
-	js += "icon_sel = document.mainForm.icon.value;\n";
+void
+nobild_server::handle_read()
+{
+	QTcpSocket *sock = qobject_cast<QTcpSocket *>(sender());
+	QByteArray &data = request[sock];
+	QByteArray path;
+	QByteArray query;
+	nobild_query q;
+	int offset;
+
+	timer.value(sock)->start(NOBILD_HTTP_TIMEOUT * 1000);
+	data += sock->readAll();
+
+	if (data.size() > NOBILD_HTTP_MAX) {
+		NobildServerReply(sock, "400 Bad Request", "text/plain", "Bad Request\n");
+		request.remove(sock);
+		return;
+	}
 
-	for (int x = 0; x != KW_MAX; x++)
-		js += QString("if (document.mainForm.kw_%1.checked) kw_mask |= %2;\n").arg(x).arg(1 << x);
-	for (int x = 0; x != OWNER_MAX; x++)
-		js += QString("if (document.mainForm.owner_%1.checked) owner_mask |= %2;\n").arg(x).arg(1 << x);
-	for (int x = 0; x != TYPE_MAX; x++)
-		js += QString("if (document.mainForm.type_%1.checked) type_mask |= %2;\n").arg(x).arg(1 << x);
-	js += "}\n";
+	/* wait for the complete request header */
+	if (data.indexOf("\r\n\r\n") < 0 && data.indexOf("\n\n") < 0)
+		return;
 
-	js += "document.mainForm.btn_gpx.onclick = function(){\n";
-	js += "var gpx_string = [];\n";
+	const QList<QByteArray> line = data.left(data.indexOf('\n')).trimmed().split(' ');
 
-	js += "update_config();\n";
+	request.remove(sock);
 
-	NobildOutputGPXParts(phead, js, QString("gpx_string"));
+	if (line.size() < 2 || line[0] != "GET") {
+		NobildServerReply(sock, "405 Method Not Allowed", "text/plain", "Method Not Allowed\n");
+		return;
+	}
 
-	js += "var gpx_len = gpx_string.length;\n";
-	js += "var gpx_array = new Uint8Array(gpx_len);\n";
-	js += "for (var x = 0; x != gpx_len; x++)\n";
-	js += "	gpx_array[x] = gpx_string[x];\n";
+	path = line[1];
+	offset = path.indexOf('?');
+	if (offset > -1) {
+		query = path.mid(offset + 1);
+		path = path.left(offset);
+	}
 
-	js += "var gpx_blob = new Blob([gpx_array], { type: \"application/x-gpx+xml\" });\n";
-	js += "var a = document.createElement('a');\n";
-	js += "a.href = window.URL.createObjectURL(gpx_blob);\n";
-	js += "a.download = 'ev_charging_stations.gpx';\n";
-	js += "a.click();\n";
-	js += "}\n";
+	if (path == "/stations.gpx")
+		q.kml = false;
+	else if (path == "/stations.kml")
+		q.kml = true;
+	else {
+		NobildServerReply(sock, "404 Not Found", "text/plain", "Not Found\n");
+		return;
+	}
 
-	js += "document.mainForm.btn_kml.onclick = function(){\n";
-	js += "var kml_string = [];\n";
+	if (NobildQueryParse(query, q)) {
+		NobildServerReply(sock, "400 Bad Request", "text/plain", "Bad Request\n");
+		return;
+	}
 
-	js += "update_config();\n";
+	const QByteArray key = NobildQueryKey(q);
+
+	server_mtx.lock();
+	if (server_index == NULL) {
+		server_mtx.unlock();
+		NobildServerReply(sock, "503 Service Unavailable", "text/plain", "Service Unavailable\n");
+		return;
+	}
 
-	NobildOutputKMLParts(phead, js, QString("kml_string"), QString("icon_sel"));
+	/* responses are cached per filter combination, up to a total size */
+	QByteArray body = server_index->cache.value(key);
 
-	js += "var kml_len = kml_string.length;\n";
-	js += "var kml_array = new Uint8Array(kml_len);\n";
-	js += "for (var x = 0; x != kml_len; x++)\n";
-	js += "	kml_array[x] = kml_string[x];\n";
+	if (body.isEmpty()) {
+		body = NobildServerQuery(server_index, q);
+		if (server_index->cache_bytes + body.size() > NOBILD_CACHE_MAX) {
+			server_index->cache.clear();
+			server_index->cache_bytes = 0;
+		}
+		if ((size_t)body.size() <= NOBILD_CACHE_MAX) {
+			server_index->cache.insert(key, body);
+			server_index->cache_bytes += body.size();
+		}
+	}
+	server_mtx.unlock();
 
-	js += "var kml_blob = new Blob([kml_array], { type: \"application/vnd.google-earth.kml+xml\" });\n";
+	NobildServerReply(sock, "200 OK", q.kml ?
+	    "application/vnd.google-earth.kml+xml" : "application/gpx+xml", body);
+}
 
-	js += "var a = document.createElement('a');\n";
-	js += "a.href = window.URL.createObjectURL(kml_blob);\n";
-	js += "a.download = 'ev_charging_stations.kml';\n";
-	js += "a.click();\n";
-	js += "}\n";
+void
+nobild_server::handle_written()
+{
+	QTcpSocket *sock = qobject_cast<QTcpSocket *>(sender());
+	QTimer *ptimer = timer.value(sock);
 
-	QFile file(output_file);
+	if (ptimer != NULL)
+		ptimer->start(NOBILD_HTTP_TIMEOUT * 1000);
+}
 
-	if (!file.open(QFile::WriteOnly | QFile::Truncate))
-		return (EINVAL);
+void
+nobild_server::handle_timeout()
+{
+	QTcpSocket *sock = qobject_cast<QTcpSocket *>(sender()->parent());
 
-	file.write(js.toUtf8());
-	file.close();
-	return (0);
+	/* the socket emits disconnected(), which frees it */
+	sock->abort();
 }
 
-static void
-usage(void)
+void
+nobild_server::handle_disconnect()
 {
-	fprintf(stderr, "usage: nobild -o <filename.js> -a <apikey>\n");
-	exit(EX_USAGE);
+	QTcpSocket *sock = qobject_cast<QTcpSocket *>(sender());
+	QTimer *ptimer = timer.take(sock);
+
+	if (ptimer != NULL)
+		ptimer->stop();
+	request.remove(sock);
+	sock->deleteLater();
 }
 
-static void *
-worker(void *)
+static const char *nobild_phase_name[PHASE_MAX] = {
+	"fetch",
+	"parse",
+	"sort",
+	"output",
+};
+
+static void
+NobildStatsPrint(const nobild_store *pstore)
 {
-	nobild_head_t head;
+	const bool json = (stats_mode == STATS_JSON);
+	QVector<size_t> count[DIM_MAX];
+	struct rusage ru;
+	nobild_sink out;
 
-	TAILQ_INIT(&head);
+	for (int d = 0; d != DIM_MAX; d++)
+		count[d].fill(0, nobild_dims[d].choices);
 
-top:
-	NobildCleanup(&head);
+	for (size_t x = 0; x != pstore->count; x++) {
+		const nobild_station *pst = &pstore->pdata[x];
 
-	QProcess fetch;
+		for (int d = 0; d != DIM_MAX; d++) {
+			for (int y = 0; y != nobild_dims[d].choices; y++) {
+				if (NobildKeyChoice(pst->sort_key, d, y))
+					count[d][y]++;
+			}
+		}
+	}
 
-	QStringList args;
+	/* ru_maxrss is in kilobytes */
+	if (getrusage(RUSAGE_SELF, &ru) != 0)
+		ru.ru_maxrss = 0;
 
-	args << "-qo" << "/dev/stdout" << QString("http://nobil.no/api/server/datadump.php?apikey=%1&format=xml&file=false").arg(apikey);
+	if (json) {
+		out += "{\"phases\":{";
+		for (int x = 0; x != PHASE_MAX; x++) {
+			out += QString("%1\"%2\":{\"wall\":%3,\"cpu\":%4}")
+			    .arg(x ? "," : "").arg(nobild_phase_name[x])
+			    .arg(stats.wall[x], 0, 'f', 6).arg(stats.cpu[x], 0, 'f', 6);
+		}
+		out += QString("},\"input_bytes\":%1,\"output_bytes\":%2,\"peak_rss_kb\":%3,"
+		    "\"stations\":%4,\"rejected\":{\"position\":%5,\"public\":%6,\"capacity\":%7},")
+		    .arg(stats.input_bytes).arg(stats.output_bytes).arg((long long)ru.ru_maxrss)
+		    .arg(pstore->count).arg(pstore->rejected_position).arg(pstore->rejected_public)
+		    .arg(pstore->rejected_capacity);
+		for (int d = 0; d != DIM_MAX; d++) {
+			out += QString("%1\"%2\":{").arg(d ? "}," : "").arg(nobild_dims[d].stats);
+			for (int x = 0; x != nobild_dims[d].choices; x++) {
+				if (x != 0)
+					out += ',';
+				JavaScriptEscape(out, NobildDimChoice(d, x));
+				out += QString(":%1").arg(count[d][x]);
+			}
+		}
+		out += "},\"groups\":[";
+		for (int x = 0; x != stats.groups.size(); x++) {
+			const nobild_group_stats &gs = stats.groups[x];
+
+			out += x ? ",{" : "{";
+			for (int d = 0; d != DIM_MAX; d++) {
+				out += QString("\"%1\":").arg(nobild_dims[d].name);
+				JavaScriptEscape(out, NobildKeyText(gs.key, d));
+				out += ',';
+			}
+			out += QString("\"stations\":%1,\"bytes\":%2}")
+			    .arg(gs.stations).arg(gs.bytes);
+		}
+		out += "]}\n";
+	} else {
+		for (int x = 0; x != PHASE_MAX; x++) {
+			out += QString("%1 %2 s wall, %3 s cpu\n")
+			    .arg(QString::fromLatin1(nobild_phase_name[x]), -8)
+			    .arg(stats.wall[x], 0, 'f', 3).arg(stats.cpu[x], 0, 'f', 3);
+		}
+		out += QString("input    %1 bytes, %2 MB/s parsed\n")
+		    .arg(stats.input_bytes)
+		    .arg(stats.wall[PHASE_PARSE] > 0 ?
+		    stats.input_bytes / stats.wall[PHASE_PARSE] / 1000000.0 : 0.0, 0, 'f', 1);
+		out += QString("output   %1 bytes, %2 MB/s written\n")
+		    .arg(stats.output_bytes)
+		    .arg(stats.wall[PHASE_OUTPUT] > 0 ?
+		    stats.output_bytes / stats.wall[PHASE_OUTPUT] / 1000000.0 : 0.0, 0, 'f', 1);
+		out += QString("memory   %1 kB peak RSS\n").arg((long long)ru.ru_maxrss);
+		out += QString("stations %1, %2 rejected by position, %3 not public\n")
+		    .arg(pstore->count).arg(pstore->rejected_position)
+		    .arg(pstore->rejected_public);
+		out += QString("capacity %1 unparsable values\n")
+		    .arg(pstore->rejected_capacity);
+		for (int d = 0; d != DIM_MAX; d++) {
+			for (int x = 0; x != nobild_dims[d].choices; x++) {
+				out += QString("%1 %2 %3\n")
+				    .arg(QString::fromLatin1(nobild_dims[d].name), -8)
+				    .arg(NobildDimChoice(d, x), -24).arg(count[d][x]);
+			}
+		}
+		for (int x = 0; x != stats.groups.size(); x++) {
+			const nobild_group_stats &gs = stats.groups[x];
+			QString key;
+
+			for (int d = 0; d != DIM_MAX; d++) {
+				if (d != 0)
+					key += " ";
+				key += NobildKeyText(gs.key, d);
+			}
+			out += QString("group    %1: %2 stations, %3 bytes\n")
+			    .arg(key).arg(gs.stations).arg(gs.bytes);
+		}
+	}
 
-	fetch.start("fetch", args);
-	fetch.waitForFinished(-1);
+	fwrite(out.buffer.constData(), 1, out.buffer.size(), stdout);
+	fflush(stdout);
+}
 
-	if (fetch.exitStatus() != QProcess::NormalExit) {
-		sleep(3600);
-		goto top;
+static int
+NobildKWParse(const char *str)
+{
+	QVector<uint16_t> limit;
+
+	/* ascending list of kW values, separated by comma */
+	while (1) {
+		const char *end = strchr(str, ',');
+		const int len = (end != NULL) ? (int)(end - str) : (int)strlen(str);
+		int64_t value;
+
+		if (limit.size() == NOBILD_KW_MAX - 1 ||
+		    NobildParseFixed(str, len, 1, ".", value) != len ||
+		    value <= 0 || value > UINT16_MAX ||
+		    (!limit.isEmpty() && value <= limit.last()))
+			return (EINVAL);
+		limit.append(value);
+
+		if (end == NULL)
+			break;
+		str = end + 1;
 	}
+	kw_limit = limit;
+	return (0);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: nobild -o <filename.js> [-D <filename.json> [-T <degrees>]] [-c] [-d <seconds>] [-S <port>] [-e gpx|kml|geojson|csv|bin:<filename> ...] [-F xml|json] [-r <rules>] [-k <kW,...>] [-B|--stats[=json]] [-t <seconds>] -a <apikey>\n"
+	    "       nobild -o <filename.js> [-D <filename.json> [-T <degrees>]] [-c] [-d <seconds>] [-S <port>] [-e gpx|kml|geojson|csv|bin:<filename> ...] [-F xml|json] [-r <rules>] [-k <kW,...>] [-B|--stats[=json]] [-t <seconds>] -u <url>\n"
+	    "       nobild -o <filename.js> [-D <filename.json> [-T <degrees>]] [-c] [-d <seconds>] [-S <port>] [-e gpx|kml|geojson|csv|bin:<filename> ...] [-F xml|json] [-r <rules>] [-k <kW,...>] [-B|--stats[=json]] -i <filename|-> [-j <threads>]\n"
+	    "       nobild [-F xml|json] -G <stations>\n");
+	exit(EX_USAGE);
+}
+
+static void *
+worker(void *)
+{
+	nobild_store store;
+	QByteArray digest_last;
+
+	while (1) {
+		QCryptographicHash hash(QCryptographicHash::Sha1);
+		QByteArray last_modified;
+		QByteArray etag;
+		double pt[2];
+		int error;
+
+		stats.clear();
+		NobildStatsStart(pt);
+
+		if (!input_file.isEmpty()) {
+			error = NobildParseFile(input_file, &store, hash);
+			if (error != 0 && daemon_interval == 0) {
+				errx(EX_NOINPUT, "Cannot read '%s'",
+				    input_file.toLocal8Bit().constData());
+			}
+		} else {
+			error = NobildFetchXML(&store, hash, last_modified, etag);
+
+			/* the datadump is not modified since the last output */
+			if (error == EALREADY) {
+				if (daemon_interval == 0)
+					break;
+				sleep(daemon_interval);
+				continue;
+			}
+		}
+
+		NobildCleanupPrev();
+
+		/* parsing is interleaved with reading, so subtract it */
+		NobildStatsStop(PHASE_FETCH, pt);
+		stats.wall[PHASE_FETCH] -= stats.wall[PHASE_PARSE];
+		stats.cpu[PHASE_FETCH] -= stats.cpu[PHASE_PARSE];
+
+		/* skip sorting and output when the datadump is unchanged */
+		if (error == 0 && hash.result() != digest_last) {
+			NobildStatsStart(pt);
+			NobildSortXML(&store);
+			NobildStatsStop(PHASE_SORT, pt);
+
+			NobildStatsStart(pt);
+			error = NobildOutputJS(&store);
+			if (error == 0)
+				error = NobildOutputEmitters(&store);
+			NobildStatsStop(PHASE_OUTPUT, pt);
+
+			if (error == 0) {
+				digest_last = hash.result();
+				if (server_port != 0)
+					NobildServerUpdate(&store);
+				if (stats_mode != STATS_NONE)
+					NobildStatsPrint(&store);
+			} else if (!input_file.isEmpty() && daemon_interval == 0) {
+				errx(EX_CANTCREAT, "Cannot write '%s'",
+				    output_file.toLocal8Bit().constData());
+			}
+		}
 
-	QByteArray data = fetch.readAllStandardOutput();
+		/* only ask for changes once the output is up to date */
+		if (error == 0) {
+			fetch_modified = last_modified;
+			fetch_etag = etag;
+		}
 
-	NobildParseXML(data, &head);
+		if (daemon_interval != 0) {
+			NobildRetain(&store);
+			sleep(daemon_interval);
+			continue;
+		}
 
-	NobildSortXML(&head);
+		store.clear();
 
-	if (NobildOutputJS(&head)) {
-		sleep(3600);
-		goto top;
+		if (error != 0)
+			sleep(3600);
+		else
+			break;
 	}
 
-	NobildCleanup(&head);
+	/* keep serving the last output */
+	if (server_port != 0)
+		return (NULL);
 
 	exit(0);
 	return (NULL);
@@ -921,11 +3887,17 @@ int
 main(int argc, char **argv)
 {
 	QApplication app(argc, argv);
-	const char *optstring = "a:o:h?";
+	const char *optstring = "a:BcD:d:e:F:G:i:j:k:o:r:S:T:t:u:h?";
+	static const struct option longopts[] = {
+		{ "stats", optional_argument, NULL, 'S' + 256 },
+		{ NULL, 0, NULL, 0 }
+	};
 	pthread_t td;
+	long generate = 0;
+	int line;
 	int c;
 
-	while ((c = getopt(argc, argv, optstring)) != -1) {
+	while ((c = getopt_long(argc, argv, optstring, longopts, NULL)) != -1) {
 		switch (c) {
 		case 'o':
 			output_file = QString::fromLatin1(optarg);
@@ -933,18 +3905,144 @@ main(int argc, char **argv)
 		case 'a':
 			apikey = QString::fromLatin1(optarg);
 			break;
+		case 'D':
+			data_file = QString::fromLocal8Bit(optarg);
+			break;
+		case 'd':
+			if (atoi(optarg) < 1)
+				usage();
+			daemon_interval = atoi(optarg);
+			break;
+		case 't':
+			fetch_timeout = atoi(optarg);
+			if (fetch_timeout < 1)
+				usage();
+			break;
+		case 'u':
+			fetch_url = QString::fromLocal8Bit(optarg);
+			break;
+		case 'B':
+			stats_mode = STATS_TEXT;
+			break;
+		case 'S' + 256:
+			if (optarg == NULL || strcmp(optarg, "text") == 0)
+				stats_mode = STATS_TEXT;
+			else if (strcmp(optarg, "json") == 0)
+				stats_mode = STATS_JSON;
+			else
+				usage();
+			break;
+		case 'G':
+			generate = atol(optarg);
+			if (generate < 1 || generate > 10000000)
+				usage();
+			break;
+		case 'e':
+			if (emit_format.size() == EMIT_MAX * 4)
+				usage();
+			else if (strncmp(optarg, "gpx:", 4) == 0)
+				emit_format.append(EMIT_GPX);
+			else if (strncmp(optarg, "kml:", 4) == 0)
+				emit_format.append(EMIT_KML);
+			else if (strncmp(optarg, "geojson:", 8) == 0)
+				emit_format.append(EMIT_GEOJSON);
+			else if (strncmp(optarg, "csv:", 4) == 0)
+				emit_format.append(EMIT_CSV);
+			else if (strncmp(optarg, "bin:", 4) == 0)
+				emit_format.append(EMIT_BINARY);
+			else
+				usage();
+			emit_file.append(QString::fromLocal8Bit(strchr(optarg, ':') + 1));
+			break;
+		case 'S':
+			server_port = atoi(optarg);
+			if (server_port < 1 || server_port > 65535)
+				usage();
+			break;
+		case 'c':
+			coord_stream = true;
+			break;
+		case 'T':
+			tile_size = atof(optarg);
+			if (tile_size < 0.1 || tile_size > 90)
+				usage();
+			break;
+		case 'F':
+			if (strcmp(optarg, "xml") == 0)
+				input_format = FORMAT_XML;
+			else if (strcmp(optarg, "json") == 0)
+				input_format = FORMAT_JSON;
+			else
+				usage();
+			break;
+		case 'i':
+			input_file = QString::fromLocal8Bit(optarg);
+			break;
+		case 'k':
+			if (NobildKWParse(optarg))
+				usage();
+			break;
+		case 'r':
+			rules_file = QString::fromLocal8Bit(optarg);
+			break;
+		case 'j':
+			num_threads = atoi(optarg);
+			if (num_threads < 1 || num_threads > NOBILD_MAX_THREADS)
+				usage();
+			break;
 		default:
 			usage();
 			break;
 		}
 	}
 
+	if (generate != 0) {
+		if (NobildGenerate(generate))
+			errx(EX_IOERR, "Cannot write datadump");
+		return (0);
+	}
+
 	if (output_file.isEmpty())
 		usage();
 
-	if (apikey.isEmpty())
+	if (apikey.isEmpty() && fetch_url.isEmpty() && input_file.isEmpty())
+		usage();
+
+	/* tiles are only written to separate data files */
+	if (tile_size != 0 && data_file.isEmpty())
+		usage();
+
+	/* standard input can only be read once */
+	if (daemon_interval != 0 && input_file == "-")
 		usage();
 
+	if (rules_file.isEmpty()) {
+		if (NobildRulesParse(QByteArray(nobild_default_rules), line))
+			errx(EX_SOFTWARE, "Invalid built-in rule at line %d", line);
+	} else {
+		QFile file(rules_file);
+
+		if (!file.open(QFile::ReadOnly))
+			errx(EX_NOINPUT, "Cannot read '%s'", rules_file.toLocal8Bit().constData());
+		if (NobildRulesParse(file.readAll(), line))
+			errx(EX_DATAERR, "Invalid rule at line %d in '%s'", line,
+			    rules_file.toLocal8Bit().constData());
+	}
+
+	if (kw_limit.isEmpty())
+		NobildKWParse("20,40,80,160");
+	NobildDimInit();
+
+	if (server_port != 0) {
+		nobild_server *psrv = new nobild_server;
+
+		QObject::connect(&psrv->server, SIGNAL(newConnection()),
+		    psrv, SLOT(handle_connection()));
+
+		if (!psrv->server.listen(QHostAddress::Any, server_port))
+			errx(EX_UNAVAILABLE, "Cannot listen on port %d", server_port);
+	}
+
 	if (pthread_create(&td, 0, &worker, 0))
 		err(EX_SOFTWARE, "Cannot create worker thread");
 
@@ -35,104 +35,584 @@
 #include <iostream>
 #include <ctype.h>
 #include <stdlib.h>
-
-#include <sys/queue.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <sys/resource.h>
 
 #include <QApplication>
 #include <QXmlStreamReader>
 #include <QString>
-#include <QProcess>
 #include <QFile>
+#include <QFileInfo>
 #include <QLocale>
+#include <QCryptographicHash>
+#include <QHash>
+#include <QNetworkAccessManager>
+#include <QNetworkRequest>
+#include <QNetworkReply>
+#include <QEventLoop>
+#include <QTimer>
+#include <QUrl>
+#include <QVector>
+#include <QMutex>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QHostAddress>
+
+#if (QT_VERSION >= 0x050100)
+#include <QSaveFile>
+#else
+/* write a temporary file, which replaces the file on commit */
+class QSaveFile : public QFile {
+public:
+	QSaveFile(const QString &name) : QFile(name + ".tmp"), target(name) {};
+	~QSaveFile() {
+		if (isOpen()) {
+			close();
+			remove();
+		}
+	};
+
+	QString target;
+
+	bool commit() {
+		close();
+		return (::rename(QFile::encodeName(fileName()).constData(),
+		    QFile::encodeName(target).constData()) == 0);
+	};
+};
+#endif
 
 #define	NOBILD_MAX_TAGS 32
+#define	NOBILD_READ_SIZE 65536
+#define	NOBILD_SINK_SIZE 65536
+#define	NOBILD_MAX_THREADS 64
+#define	NOBILD_OWNER_MAX 32		/* including the fallback owner */
+#define	NOBILD_TYPE_MAX 8		/* including the fallback plug type */
+#define	NOBILD_KW_MAX 16		/* number of kW ranges */
+#define	NOBILD_KEY_BITS (NOBILD_OWNER_MAX + NOBILD_KW_MAX + (1 << NOBILD_TYPE_MAX) + 2)
+#define	NOBILD_KEY_WORDS ((NOBILD_KEY_BITS + 63) / 64)
+#define	NOBILD_HASH_INIT 14695981039346656037ULL	/* FNV-1a */
+#define	NOBILD_HASH_PRIME 1099511628211ULL
+#define	NOBILD_HTTP_MAX 8192
+#define	NOBILD_HTTP_TIMEOUT 30		/* seconds without progress */
+#define	NOBILD_CACHE_MAX (64 * 1024 * 1024)	/* bytes */
 
 enum {
-	TYPE_CCS,
-	TYPE_CHADEMO,
-	TYPE_2,
-	TYPE_TESLA,
-	TYPE_OTHER,
-	TYPE_MAX,
+	DIM_OWNER,
+	DIM_KW,
+	DIM_TYPE,
+	DIM_24H,
+	DIM_MAX,
 };
 
 enum {
-	OWNER_FORTUM,
-	OWNER_GRONNKONTAKT,
-	OWNER_BEE,
-	OWNER_BKK,
-	OWNER_CLEVER,
-	OWNER_EON,
-	OWNER_TESLA,
-	OWNER_IONITY,
-	OWNER_OTHER,
-	OWNER_MAX,
+	ICON_Z,
+	ICON_S,
+	ICON_MAX,
 };
 
 enum {
-	KW_0_20,
-	KW_20_40,
-	KW_40_80,
-	KW_80_160,
-	KW_160_MAX,
-	KW_MAX,
+	TAG_UNKNOWN,
+	TAG_CHARGERSTATIONS,
+	TAG_CHARGERSTATION,
+	TAG_METADATA,
+	TAG_ID,
+	TAG_POSITION,
+	TAG_NAME,
+	TAG_OWNED_BY,
+	TAG_USER_COMMENT,
+	TAG_ATTRIBUTES,
+	TAG_STATION,
+	TAG_CONNECTORS,
+	TAG_CONNECTOR,
+	TAG_ATTRIBUTE,
+	TAG_ATTRTYPEID,
+	TAG_ATTRVALID,
+	TAG_TRANS,
+	TAG_MAX,
 };
 
 enum {
-	ICON_Z,
-	ICON_S,
-	ICON_MAX,
+	STATE_NONE,
+	STATE_ROOT,
+	STATE_STATION,
+	STATE_METADATA,
+	STATE_ATTRIBUTES,
+	STATE_STATION_LIST,
+	STATE_STATION_ATTR,
+	STATE_CONNECTORS,
+	STATE_CONNECTOR,
+	STATE_CONNECTOR_ATTR,
+	STATE_TEXT,
+	STATE_SKIP,
+};
+
+enum {
+	FORMAT_XML,
+	FORMAT_JSON,
+};
+
+enum {
+	EMIT_GPX,
+	EMIT_KML,
+	EMIT_GEOJSON,
+	EMIT_CSV,
+	EMIT_BINARY,
+	EMIT_MAX,
 };
 
 enum {
-	KW_0_20_MASK = 1 << KW_0_20,
-	KW_20_40_MASK = 1 << KW_20_40,
-	KW_40_80_MASK = 1 << KW_40_80,
-	KW_80_160_MASK = 1 << KW_80_160,
-	KW_160_MAX_MASK = 1 << KW_160_MAX,
+	PHASE_FETCH,
+	PHASE_PARSE,
+	PHASE_SORT,
+	PHASE_OUTPUT,
+	PHASE_MAX,
 };
 
-class nobild_cache {
+enum {
+	STATS_NONE,
+	STATS_TEXT,
+	STATS_JSON,
+};
+
+/* capacities are stored in units of 0.1 kW */
+#define	NOBILD_KW(x) ((x) * 10)
+
+/* coordinates are stored in units of microdegrees */
+#define	NOBILD_DEG(x) ((x) * 1000000)
+#define	NOBILD_COORD_UNIT 10		/* coordinate stream resolution, in microdegrees */
+
+enum {
+	FLAG_OWNER = 1 << 0,	/* title is prefixed by the owner name */
+	FLAG_24H = 1 << 1,
+};
+
+class nobild_station {
 public:
-	TAILQ_CLASS_ENTRY(nobild_cache) entry;
-	QString output_gpx;
-	QString output_kml;
-	int owner;
-	float capacity_min;
-	float capacity_max;
-  	size_t type[TYPE_MAX];
+	uint64_t hash;
+	uint32_t sort_key;
+	uint32_t tile;
+	uint32_t morton;
+	uint32_t id_offset;
+	uint32_t name_offset;
+	uint16_t id_length;
+	uint16_t name_length;
+	int32_t lat;
+	int32_t lon;
+	uint16_t capacity_min;
+	uint16_t capacity_max;
+	uint16_t type[NOBILD_TYPE_MAX];
+	uint8_t owner;
+	uint8_t flags;
+
+	uint32_t get_type_mask() const {
+		uint32_t type_mask = 0;
 
-	int64_t get_owner_mask() const {
-		return (1LL << owner);
+		for (int x = 0; x != NOBILD_TYPE_MAX; x++) {
+			if (type[x] != 0)
+				type_mask |= 1U << x;
+		}
+		return (type_mask);
 	}
+};
 
-	int64_t get_kw_mask() const {
-		int64_t kw_mask = 0;
-
-		if (capacity_max >= 0 && capacity_max < 20)
-			kw_mask |= KW_0_20_MASK;
-		if (capacity_max >= 20 && capacity_max < 40)
-			kw_mask |= KW_20_40_MASK;
-		if (capacity_max >= 40 && capacity_max < 80)
-			kw_mask |= KW_40_80_MASK;
-		if (capacity_max >= 80 && capacity_max < 160)
-			kw_mask |= KW_80_160_MASK;
-		if (capacity_max >= 160)
-			kw_mask |= KW_160_MAX_MASK;
-		return (kw_mask);
+/* an owner or plug type, as given by the rules */
+class nobild_class {
+public:
+	nobild_class() {};
+	nobild_class(const QString &_name, const QString &_full, const QString &_link) :
+	    name(_name), full(_full), link(_link) {};
+
+	QString name;
+	QString full;
+	QString link;
+};
+
+/*
+ * Case insensitive multi-pattern matcher, after Aho and Corasick,
+ * mapping a string to the value of the first added pattern found in
+ * it. Prefix patterns only match at the start of the string.
+ */
+class nobild_matcher {
+public:
+	nobild_matcher() { clear(); };
+
+	QHash<uint64_t, int> next;	/* (state << 16) | character */
+	QVector<int> parent;
+	QVector<ushort> symbol;
+	QVector<int> depth;
+	QVector<int> fail;
+	QVector<int> out;		/* first pattern ending in state */
+	QVector<int> dict;		/* next state on the fail chain with a pattern */
+	QVector<int> value;
+	QVector<int> length;
+	QVector<bool> prefix;
+
+	void clear();
+	void add(const QString &, int, bool);
+	void build();
+	int match(const QString &, int) const;
+};
+
+/*
+ * A filter dimension. Each station has one value in every dimension,
+ * and the values of all dimensions together form its key. For a set
+ * dimension the value is a bit mask of choices, any of which selects
+ * the station. Otherwise the value is the choice itself.
+ */
+class nobild_dim {
+public:
+	const char *name;
+	const char *title;
+	const char *stats;
+	bool set;
+	int choices;			/* number of checkboxes */
+	int values;			/* number of values */
+	int offset;			/* first bit in the key bitset */
+	uint32_t stride;		/* place in the key */
+};
+
+/*
+ * The key as a bitset, with one bit for the value of the station in
+ * each dimension. A station is filtered out when its bitset has any
+ * bit in common with the bitset of the unselected values.
+ */
+class nobild_key {
+public:
+	nobild_key() { clear(); };
+
+	uint64_t word[NOBILD_KEY_WORDS];
+
+	void clear() {
+		memset(word, 0, sizeof(word));
 	}
 
-	int64_t get_type_mask()  const {
-		int64_t type_mask = 0;
+	void set(int bit) {
+		word[bit / 64] |= 1ULL << (bit % 64);
+	}
 
-		for (int x = 0; x != TYPE_MAX; x++) {
-			if (type[x] != 0)
-				type_mask |= 1LL << x;
+	bool intersects(const nobild_key &other) const {
+		uint64_t temp = 0;
+
+		for (int x = 0; x != NOBILD_KEY_WORDS; x++)
+			temp |= word[x] & other.word[x];
+		return (temp != 0);
+	}
+};
+
+/*
+ * Contiguous array of stations. All variable length strings are
+ * stored as UTF-8 in a single arena, and referred to by offset.
+ */
+class nobild_store {
+public:
+	nobild_store() : pdata(NULL), count(0), max(0),
+	    rejected_position(0), rejected_public(0), rejected_capacity(0) {};
+	~nobild_store() { free(pdata); };
+
+	nobild_station *pdata;
+	size_t count;
+	size_t max;
+	QByteArray arena;
+	size_t rejected_position;
+	size_t rejected_public;
+	size_t rejected_capacity;
+
+	nobild_station *alloc() {
+		if (count == max) {
+			max = max ? 2 * max : 256;
+			pdata = (nobild_station *)realloc(pdata, max * sizeof(pdata[0]));
+			if (pdata == NULL)
+				errx(EX_SOFTWARE, "Out of memory");
 		}
-		return (type_mask);
+		return (&pdata[count++]);
+	}
+
+	const char *text(uint32_t offset) const {
+		return (arena.constData() + offset);
+	}
+
+	void clear() {
+		free(pdata);
+		pdata = NULL;
+		count = max = 0;
+		arena = QByteArray();
+		rejected_position = rejected_public = rejected_capacity = 0;
 	}
+
+	void swap(nobild_store &other) {
+		nobild_station *ptemp = pdata;
+		size_t temp;
+
+		pdata = other.pdata;
+		other.pdata = ptemp;
+		temp = count;
+		count = other.count;
+		other.count = temp;
+		temp = max;
+		max = other.max;
+		other.max = temp;
+		temp = rejected_position;
+		rejected_position = other.rejected_position;
+		other.rejected_position = temp;
+		temp = rejected_public;
+		rejected_public = other.rejected_public;
+		other.rejected_public = temp;
+		temp = rejected_capacity;
+		rejected_capacity = other.rejected_capacity;
+		other.rejected_capacity = temp;
+		arena.swap(other.arena);
+	}
+private:
+	nobild_store(const nobild_store &);
+	nobild_store &operator=(const nobild_store &);
 };
 
-typedef TAILQ_CLASS_HEAD(, nobild_cache) nobild_head_t;
+class nobild_parse {
+public:
+	nobild_parse() : ptext(NULL), si(0), skip(0), key(TAG_UNKNOWN), depth(0) {
+		state[0] = STATE_NONE;
+	};
+
+	QXmlStreamReader xml;
+	uint8_t state[NOBILD_MAX_TAGS];
+	QString *ptext;
+	uint64_t hash;
+	QString id;
+	QString position;
+	QString name;
+	QString owned_by;
+	QString user_comment;
+	QString attrtypeid;
+	QString attrvalid;
+	QString trans;
+	uint16_t opt_capacity_min;
+	uint16_t opt_capacity_max;
+	size_t opt_type[NOBILD_TYPE_MAX];
+	int opt_public;
+	int opt_24h;
+	size_t si;
+	size_t skip;
+	int key;
+	size_t depth;
+	QByteArray json;
+};
+
+/*
+ * UTF-8 output buffer. When a device is given, the buffer is written
+ * to it in large blocks as it fills up, so that the complete output
+ * never needs to be held in memory.
+ */
+class nobild_sink {
+public:
+	nobild_sink(QIODevice *_pdev = NULL) : pdev(_pdev), total(0), error(0) {
+		if (pdev != NULL)
+			buffer.reserve(NOBILD_SINK_SIZE);
+	};
+
+	QIODevice *pdev;
+	QByteArray buffer;
+	uint64_t total;
+	int error;
+
+	void flush() {
+		if (pdev == NULL || buffer.isEmpty())
+			return;
+		if (pdev->write(buffer) != buffer.size())
+			error = EIO;
+		buffer.resize(0);
+	}
+
+	void append(const char *ptr, int len) {
+		buffer.append(ptr, len);
+		total += len;
+		if (pdev != NULL && buffer.size() >= NOBILD_SINK_SIZE)
+			flush();
+	}
+
+	nobild_sink &operator +=(char ch) {
+		append(&ch, 1);
+		return (*this);
+	}
+
+	nobild_sink &operator +=(const char *str) {
+		append(str, strlen(str));
+		return (*this);
+	}
+
+	nobild_sink &operator +=(const QByteArray &str) {
+		append(str.constData(), str.size());
+		return (*this);
+	}
+
+	nobild_sink &operator +=(const QString &str) {
+		return (*this += str.toUtf8());
+	}
+};
+
+class nobild_group {
+public:
+	nobild_group() : hash(0) {};
+
+	uint64_t hash;
+	QByteArray text;
+};
+
+class nobild_group_stats {
+public:
+	uint32_t key;
+	size_t stations;
+	uint64_t bytes;
+};
+
+class nobild_stats {
+public:
+	nobild_stats() { clear(); };
+
+	double wall[PHASE_MAX];
+	double cpu[PHASE_MAX];
+	uint64_t input_bytes;
+	uint64_t output_bytes;
+	QVector<nobild_group_stats> groups;
+
+	void clear() {
+		for (int x = 0; x != PHASE_MAX; x++)
+			wall[x] = cpu[x] = 0;
+		input_bytes = output_bytes = 0;
+		groups.clear();
+	}
+};
+
+/*
+ * Output format, driven by NobildEmit() in a single pass over the
+ * sorted stations. The title is rendered once and shared by all
+ * formats. The count is the number of stations emitted so far.
+ */
+class nobild_emitter {
+public:
+	nobild_emitter(nobild_sink &_output) : output(_output), count(0) {};
+	virtual ~nobild_emitter() {};
+
+	virtual void header(const nobild_store *) {};
+	virtual void station(const nobild_store *, const nobild_station *,
+	    const QByteArray &title) = 0;
+	virtual void footer(const nobild_store *) {};
+
+	nobild_sink &output;
+	size_t count;
+};
+
+class nobild_emit_gpx : public nobild_emitter {
+public:
+	nobild_emit_gpx(nobild_sink &_output) : nobild_emitter(_output) {};
+
+	void header(const nobild_store *);
+	void station(const nobild_store *, const nobild_station *, const QByteArray &);
+	void footer(const nobild_store *);
+};
+
+class nobild_emit_kml : public nobild_emitter {
+public:
+	nobild_emit_kml(nobild_sink &_output) : nobild_emitter(_output) {};
+
+	void header(const nobild_store *);
+	void station(const nobild_store *, const nobild_station *, const QByteArray &);
+	void footer(const nobild_store *);
+};
+
+class nobild_emit_geojson : public nobild_emitter {
+public:
+	nobild_emit_geojson(nobild_sink &_output) : nobild_emitter(_output) {};
+
+	void header(const nobild_store *);
+	void station(const nobild_store *, const nobild_station *, const QByteArray &);
+	void footer(const nobild_store *);
+};
+
+class nobild_emit_csv : public nobild_emitter {
+public:
+	nobild_emit_csv(nobild_sink &_output) : nobild_emitter(_output) {};
+
+	void header(const nobild_store *);
+	void station(const nobild_store *, const nobild_station *, const QByteArray &);
+};
+
+class nobild_emit_binary : public nobild_emitter {
+public:
+	nobild_emit_binary(nobild_sink &_output) : nobild_emitter(_output) {};
+
+	void header(const nobild_store *);
+	void station(const nobild_store *, const nobild_station *, const QByteArray &);
+};
+
+/*
+ * Ready-made GPX and KML fragments for every station, stored in sort
+ * order, so that a query only needs to concatenate byte ranges.
+ */
+class nobild_index_group {
+public:
+	nobild_key key;
+	size_t first;
+	size_t last;
+	int32_t lat_min;
+	int32_t lat_max;
+	int32_t lon_min;
+	int32_t lon_max;
+};
+
+class nobild_index {
+public:
+	QByteArray gpx;
+	QByteArray kml;
+	QVector<uint32_t> gpx_offset;
+	QVector<uint32_t> kml_offset;
+	QVector<int32_t> lat;
+	QVector<int32_t> lon;
+	QVector<nobild_index_group> groups;
+	QHash<QByteArray, QByteArray> cache;
+	size_t cache_bytes;
+
+	nobild_index() : cache_bytes(0) {};
+};
+
+/* a parsed download request */
+class nobild_query {
+public:
+	bool kml;
+	int icon;
+	int64_t mask[DIM_MAX];
+	int64_t lat_min;
+	int64_t lon_min;
+	int64_t lat_max;
+	int64_t lon_max;
+};
+
+class nobild_server : public QObject {
+	Q_OBJECT
+public:
+	QTcpServer server;
+	QHash<QTcpSocket *, QByteArray> request;
+	QHash<QTcpSocket *, QTimer *> timer;
+
+public slots:
+	void handle_connection();
+	void handle_read();
+	void handle_written();
+	void handle_timeout();
+	void handle_disconnect();
+};
+
+class nobild_chunk {
+public:
+	pthread_t td;
+	QByteArray prefix;
+	QByteArray data;
+	QByteArray suffix;
+	nobild_store store;
+	int error;
+};
 
 #endif					/* _NOBILD_H_ */